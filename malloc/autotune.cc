@@ -0,0 +1,312 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+/*
+Builds malloc.c with different values of its tuning knobs (the #ifndef
+defines at the top of malloc.c), runs every build on the same workloads and
+prints the configurations on the time vs. utilization Pareto front of each
+challenge:
+
+  ./autotune.bin [--grid | --random=N] [--seed=S] [--repeat=R]
+      [--challenge=N] [--param=NAME=V1,V2,...] [--csv=FILE] [--cc=CC]
+      [--cflags=FLAGS]
+
+--random=N (the default, N = 20) tries N distinct random points of the grid
+on top of the defaults, --grid tries all of them. --param replaces the values
+tried for one knob (--param=TREE_BIN=8 pins it). Each point is compiled with
+CC and FLAGS (default: the Makefile's CFLAGS, which `make tune` passes on) to
+autotune_tmp.bin (errors go to autotune_build.log) and run with
+  --my-only --workload-in=tune [--challenge=N]
+--repeat=R keeps the best time of R runs. The workloads tune1.wl ...
+tune5.wl are written by the first run (the defaults) if they don't exist, so
+delete them to tune on a new draw, or put e.g. tracemodel.bin output there to
+tune on a recorded workload.
+
+Every result goes to --csv (default autotune.csv): the knobs, then time [ms]
+and utilization [%] per challenge. A configuration is on the front of a
+challenge if no other one is at least as fast with at least as much
+utilization and strictly better in one of them.
+*/
+
+struct Param {
+  const char *name;
+  std::vector<long> values;
+  long default_value;
+  // What malloc.c's #error / _Static_assert checks accept, and in words.
+  bool (*valid)(long value);
+  const char *rule;
+};
+
+bool power_of_two_4096(long v) { return v >= 4096 && !(v & (v - 1)); }
+bool multiple_of_8(long v) { return v >= 8 && v % 8 == 0; }
+bool tree_bin(long v) { return v >= 3 && v < 10; }  // BIN_NUMBER = 10.
+bool non_negative(long v) { return v >= 0; }
+
+// The knobs and the values tried by default, keep in sync with malloc.c.
+std::vector<Param> params = {
+    {"BUFFER_SIZE", {4096, 8192, 16384, 65536}, 4096, power_of_two_4096,
+     "a power of two >= 4096"},
+    {"TREE_BIN", {6, 7, 8, 9}, 8, tree_bin, "in [3, 10)"},
+    {"SPLIT_MIN_SIZE", {8, 32, 128}, 8, multiple_of_8,
+     "a positive multiple of 8"},
+    {"QUICK_MAX_SIZE", {8, 128, 256, 512}, 256, multiple_of_8,
+     "a positive multiple of 8"},
+    {"MAX_DIRTY_PAGES", {0, 4, 64}, 4, non_negative, ">= 0"},
+    {"MAX_PURGED_PAGES", {0, 256, 4096}, 256, non_negative, ">= 0"},
+};
+
+const int kChallenges = 5;
+const char *kWorkloadPrefix = "tune";
+
+struct Result {
+  std::vector<long> values;  // One per param.
+  int time_ms[kChallenges + 1];
+  int utilization[kChallenges + 1];
+};
+
+std::string config_name(const std::vector<long> &values) {
+  std::string name;
+  for (size_t i = 0; i < params.size(); i++) {
+    if (values[i] == params[i].default_value) continue;
+    if (!name.empty()) name += " ";
+    name += std::string(params[i].name) + "=" + std::to_string(values[i]);
+  }
+  return name.empty() ? "(defaults)" : name;
+}
+
+bool build(const std::string &cc, const std::string &cflags,
+           const std::vector<long> &values) {
+  std::string command =
+      cc + " -o autotune_tmp.bin main.c simple_malloc.c malloc.c " + cflags;
+  for (size_t i = 0; i < params.size(); i++) {
+    command += std::string(" -D") + params[i].name + "=" +
+               std::to_string(values[i]);
+  }
+  command += " > autotune_build.log 2>&1";
+  return system(command.c_str()) == 0;
+}
+
+// Runs autotune_tmp.bin and parses its score line (time,utilization,... for
+// challenges 1 to 5) into |result|, keeping the best time.
+bool run(const std::string &args, Result *result, bool first) {
+  std::string command = "./autotune_tmp.bin --my-only " + args;
+  FILE *fp = popen(command.c_str(), "r");
+  if (!fp) return false;
+  char line[1024];
+  bool score_next = false, parsed = false;
+  while (fgets(line, sizeof(line), fp)) {
+    if (strstr(line, "copy & paste")) {
+      score_next = true;
+      continue;
+    }
+    if (!score_next) continue;
+    score_next = false;
+    char *p = line;
+    for (int c = 1; c <= kChallenges; c++) {
+      int time_ms = strtol(p, &p, 10);
+      if (*p++ != ',') break;
+      int utilization = strtol(p, &p, 10);
+      if (*p++ != ',') break;
+      if (first || time_ms < result->time_ms[c]) result->time_ms[c] = time_ms;
+      result->utilization[c] = utilization;
+      parsed = c == kChallenges;
+    }
+  }
+  return pclose(fp) == 0 && parsed;
+}
+
+bool exists(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+// The results that are not dominated in challenge |c|, by time.
+std::vector<const Result *> pareto_front(const std::vector<Result> &results,
+                                         int c) {
+  std::vector<const Result *> sorted;
+  for (const Result &r : results) sorted.push_back(&r);
+  std::sort(sorted.begin(), sorted.end(),
+            [c](const Result *a, const Result *b) {
+              if (a->time_ms[c] != b->time_ms[c])
+                return a->time_ms[c] < b->time_ms[c];
+              return a->utilization[c] > b->utilization[c];
+            });
+  std::vector<const Result *> front;
+  for (const Result *r : sorted) {
+    if (front.empty() || r->utilization[c] > front.back()->utilization[c]) {
+      front.push_back(r);
+    }
+  }
+  return front;
+}
+
+void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [--grid | --random=N] [--seed=S] [--repeat=R] "
+          "[--challenge=N]\n"
+          "    [--param=NAME=V1,V2,...] [--csv=FILE] [--cc=CC] "
+          "[--cflags=FLAGS]\n"
+          "Run it in malloc/, see the comment at the top of autotune.cc.\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  bool grid = false;
+  int random_points = 20;
+  uint64_t seed = 1;
+  int repeat = 1;
+  int challenge = 0;
+  std::string csv_file = "autotune.csv";
+  std::string cc = "cc";
+  std::string cflags = "-O3 -Wall -g -lm -pthread";
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--grid") == 0) {
+      grid = true;
+    } else if (strncmp(argv[i], "--random=", 9) == 0) {
+      random_points = atoi(argv[i] + 9);
+    } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+      seed = strtoull(argv[i] + 7, NULL, 10);
+    } else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+      repeat = std::max(1, atoi(argv[i] + 9));
+    } else if (strncmp(argv[i], "--challenge=", 12) == 0) {
+      challenge = atoi(argv[i] + 12);
+      if (challenge < 1 || challenge > kChallenges) usage(argv[0]);
+    } else if (strncmp(argv[i], "--param=", 8) == 0) {
+      const char *eq = strchr(argv[i] + 8, '=');
+      if (!eq) usage(argv[0]);
+      std::string name(argv[i] + 8, eq - (argv[i] + 8));
+      Param *param = NULL;
+      for (Param &p : params) {
+        if (name == p.name) param = &p;
+      }
+      if (!param) usage(argv[0]);
+      param->values.clear();
+      for (const char *p = eq + 1; *p;) {
+        char *end;
+        param->values.push_back(strtol(p, &end, 10));
+        if (end == p || (*end && *end != ',')) usage(argv[0]);
+        if (!param->valid(param->values.back())) {
+          fprintf(stderr, "%s must be %s\n", param->name, param->rule);
+          usage(argv[0]);
+        }
+        p = *end ? end + 1 : end;
+      }
+      if (param->values.empty()) usage(argv[0]);
+    } else if (strncmp(argv[i], "--csv=", 6) == 0) {
+      csv_file = argv[i] + 6;
+    } else if (strncmp(argv[i], "--cc=", 5) == 0) {
+      cc = argv[i] + 5;
+    } else if (strncmp(argv[i], "--cflags=", 9) == 0) {
+      cflags = argv[i] + 9;
+    } else {
+      usage(argv[0]);
+    }
+  }
+
+  // The points to try, the defaults first (they also write the workloads).
+  std::vector<std::vector<long>> points;
+  std::set<std::vector<long>> seen;
+  std::vector<long> defaults;
+  for (const Param &p : params) defaults.push_back(p.default_value);
+  points.push_back(defaults);
+  seen.insert(defaults);
+  size_t grid_size = 1;
+  for (const Param &p : params) grid_size *= p.values.size();
+  if (grid) {
+    for (size_t n = 0; n < grid_size; n++) {
+      std::vector<long> point;
+      size_t rest = n;
+      for (const Param &p : params) {
+        point.push_back(p.values[rest % p.values.size()]);
+        rest /= p.values.size();
+      }
+      if (seen.insert(point).second) points.push_back(point);
+    }
+  } else {
+    std::mt19937_64 rng(seed);
+    size_t wanted = std::min((size_t)random_points, grid_size);
+    for (size_t tries = 0; points.size() < wanted + 1 && tries < 100 * wanted;
+         tries++) {
+      std::vector<long> point;
+      for (const Param &p : params) {
+        point.push_back(p.values[rng() % p.values.size()]);
+      }
+      if (seen.insert(point).second) points.push_back(point);
+    }
+  }
+
+  std::string run_args = "--workload-in=" + std::string(kWorkloadPrefix);
+  if (challenge) run_args += " --challenge=" + std::to_string(challenge);
+  std::string first_run_args = run_args;
+  bool have_workloads = true;
+  for (int c = 1; c <= kChallenges; c++) {
+    if (!exists(kWorkloadPrefix + std::to_string(c) + ".wl"))
+      have_workloads = false;
+  }
+  if (!have_workloads) {
+    // Write all five, so that later runs can pick any challenge.
+    first_run_args = "--workload-out=" + std::string(kWorkloadPrefix);
+  }
+
+  FILE *csv = fopen(csv_file.c_str(), "w");
+  if (!csv) {
+    perror(csv_file.c_str());
+    return 1;
+  }
+  for (const Param &p : params) fprintf(csv, "%s,", p.name);
+  for (int c = 1; c <= kChallenges; c++) {
+    fprintf(csv, "time%d_ms,utilization%d%s", c, c,
+            c == kChallenges ? "\n" : ",");
+  }
+
+  std::vector<Result> results;
+  for (size_t n = 0; n < points.size(); n++) {
+    fprintf(stderr, "[%zu/%zu] %s\n", n + 1, points.size(),
+            config_name(points[n]).c_str());
+    if (!build(cc, cflags, points[n])) {
+      fprintf(stderr, "  build failed, see autotune_build.log\n");
+      continue;
+    }
+    Result result;
+    result.values = points[n];
+    bool ok = true;
+    for (int r = 0; r < repeat && ok; r++) {
+      ok = run(n == 0 && r == 0 ? first_run_args : run_args, &result, r == 0);
+    }
+    if (!ok) {
+      fprintf(stderr, "  run failed\n");
+      continue;
+    }
+    for (long v : result.values) fprintf(csv, "%ld,", v);
+    for (int c = 1; c <= kChallenges; c++) {
+      fprintf(csv, "%d,%d%s", result.time_ms[c], result.utilization[c],
+              c == kChallenges ? "\n" : ",");
+    }
+    fflush(csv);
+    results.push_back(result);
+  }
+  fclose(csv);
+  remove("autotune_tmp.bin");
+
+  for (int c = 1; c <= kChallenges; c++) {
+    if (challenge && c != challenge) continue;
+    printf("== Challenge #%d: Pareto front (%zu configurations)\n", c,
+           results.size());
+    printf("%10s %16s  %s\n", "Time [ms]", "Utilization [%]", "config");
+    for (const Result *r : pareto_front(results, c)) {
+      printf("%10d %16d  %s\n", r->time_ms[c], r->utilization[c],
+             config_name(r->values).c_str());
+    }
+  }
+  return results.empty() ? 1 : 0;
+}
@@ -7,12 +7,21 @@
 
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <time.h>
+#ifdef ENABLE_PERF_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 //
 // [Simple malloc]
@@ -30,6 +39,23 @@ void *my_malloc(size_t size);
 void my_free(void *ptr);
 void my_finalize();
 void test();
+// Optional, for the producer/consumer benchmark: my_free() from another
+// thread, and how many batches of those the owner has drained.
+void my_free_remote(void *ptr) __attribute__((weak));
+size_t my_remote_drains() __attribute__((weak));
+// Optional, for the aligned/calloc benchmark.
+void *my_aligned_alloc(size_t alignment, size_t size) __attribute__((weak));
+void *my_calloc(size_t count, size_t size) __attribute__((weak));
+// Optional, for --burst-latency: map and prefault pages ahead of the peak
+// epochs, and give back what they didn't use.
+size_t my_reserve(size_t bytes) __attribute__((weak));
+size_t my_release_reserve() __attribute__((weak));
+// Optional, for the region benchmark: bump allocation, freed all at once.
+typedef struct my_region_t my_region_t;
+my_region_t *my_region_create() __attribute__((weak));
+void *my_region_alloc(my_region_t *region, size_t size) __attribute__((weak));
+void my_region_free(my_region_t *region, void *ptr) __attribute__((weak));
+void my_region_destroy(my_region_t *region) __attribute__((weak));
 
 // This is code to run challenges. Please do NOT modify the code.
 
@@ -90,6 +116,13 @@ double get_time(void) {
   return tv.tv_sec + tv.tv_usec * 1e-6;
 }
 
+// For timing single calls.
+uint64_t get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 // Return a random number in [0, 1).
 double urand() { return rand() / ((double)RAND_MAX + 1); }
 
@@ -129,6 +162,12 @@ unsigned get_object_lifetime(unsigned min_epoch, unsigned max_epoch) {
   return result;
 }
 
+// The shape of a challenge's workload.
+#define EPOCHS_PER_CYCLE 100
+#define OBJECTS_PER_EPOCH_SMALL 100
+#define OBJECTS_PER_EPOCH_LARGE 2000
+#define CYCLES 10
+
 typedef void (*initialize_func_t)();
 typedef void *(*malloc_func_t)(size_t size);
 typedef void (*free_func_t)(void *ptr);
@@ -140,21 +179,203 @@ typedef struct stats_t {
   double end_time;
   size_t mmap_size;
   size_t munmap_size;
+  // Bytes currently purged (mapped but given back with purge_to_system()).
+  // They count as returned to the system.
+  size_t purge_size;
+  // The max of mmap_size - munmap_size - purge_size so far.
+  size_t peak_mapped_size;
+  // The number of mmap_from_system / munmap_to_system / purge_to_system calls.
+  size_t mmap_count;
+  size_t munmap_count;
+  size_t purge_count;
   size_t allocated_size;
   size_t freed_size;
+  // Hardware/software event counts over the timed region, -1 if unavailable.
+  long long dtlb_misses;
+  long long page_faults;
 } stats_t;
 
 stats_t stats;
 FILE *trace_fp;
 
-// Run one challenge.
-// |min_size|: The min size of an allocated object
-// |max_size|: The max size of an allocated object
-// |*_func|: Function pointers to initialize / malloc / free.
-void run_challenge(const char *trace_file_name, size_t min_size,
-                   size_t max_size, initialize_func_t initialize_func,
-                   malloc_func_t malloc_func, free_func_t free_func,
-                   finalize_func_t finalize_func) {
+// [Per-epoch time series]
+//
+// With --epoch-stats=PREFIX, each run records one sample at the end of every
+// epoch into a preallocated array (a few stores, no I/O in the timed region)
+// and writes them to PREFIX<challenge>_<simple|my>.csv after the clock stops.
+// Plot one with trace/epoch_stats_gnuplot.txt.
+
+typedef struct epoch_sample_t {
+  size_t live_size;  // allocated_size - freed_size
+  size_t mapped_size;  // mmap_size - munmap_size - purge_size
+  size_t peak_mapped_size;
+  size_t mmap_count;
+  size_t munmap_count;
+  size_t purge_count;
+} epoch_sample_t;
+
+const char *epoch_stats_prefix;
+// The CSV file of the current run, NULL when not sampling.
+const char *epoch_stats_file_name;
+epoch_sample_t *epoch_samples;
+size_t epoch_sample_count;
+
+void reset_stats() {
+  stats.mmap_size = stats.munmap_size = stats.purge_size = 0;
+  stats.peak_mapped_size = 0;
+  stats.mmap_count = stats.munmap_count = stats.purge_count = 0;
+  stats.allocated_size = stats.freed_size = 0;
+}
+
+void begin_epoch_samples() {
+  epoch_sample_count = 0;
+  epoch_samples = NULL;
+  if (epoch_stats_file_name) {
+    epoch_samples = (epoch_sample_t *)calloc(CYCLES * EPOCHS_PER_CYCLE,
+                                             sizeof(epoch_sample_t));
+  }
+}
+
+void record_epoch_sample(size_t live_size) {
+  if (!epoch_samples) {
+    return;
+  }
+  epoch_sample_t *sample = &epoch_samples[epoch_sample_count++];
+  sample->live_size = live_size;
+  sample->mapped_size = stats.mmap_size - stats.munmap_size - stats.purge_size;
+  sample->peak_mapped_size = stats.peak_mapped_size;
+  sample->mmap_count = stats.mmap_count;
+  sample->munmap_count = stats.munmap_count;
+  sample->purge_count = stats.purge_count;
+}
+
+void end_epoch_samples() {
+  if (!epoch_samples) {
+    return;
+  }
+  FILE *fp = fopen(epoch_stats_file_name, "w");
+  if (!fp) {
+    fprintf(stderr, "Failed to open an epoch stats file: %s\n",
+            epoch_stats_file_name);
+    exit(EXIT_FAILURE);
+  }
+  fprintf(fp,
+          "epoch,live_bytes,mapped_bytes,peak_mapped_bytes,mmap_calls,"
+          "munmap_calls,purge_calls\n");
+  for (size_t i = 0; i < epoch_sample_count; i++) {
+    epoch_sample_t *sample = &epoch_samples[i];
+    fprintf(fp, "%zu,%zu,%zu,%zu,%zu,%zu,%zu\n", i, sample->live_size,
+            sample->mapped_size, sample->peak_mapped_size, sample->mmap_count,
+            sample->munmap_count, sample->purge_count);
+  }
+  fclose(fp);
+  free(epoch_samples);
+  epoch_samples = NULL;
+}
+
+#ifdef ENABLE_PERF_COUNTERS
+// Counters opened once for the whole process, -1 if the kernel (or the VM)
+// does not provide them.
+int dtlb_misses_fd = -2;
+int page_faults_fd = -2;
+
+int perf_counter_open(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+long long perf_counter_read(int fd) {
+  long long value;
+  if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) {
+    return -1;
+  }
+  return value;
+}
+#endif
+
+// Snapshot the counters at the beginning (|sign| = -1) and the end (|sign| =
+// 1) of the timed region, so that the stats hold the difference.
+void sample_perf_counters(int sign) {
+#ifdef ENABLE_PERF_COUNTERS
+  if (dtlb_misses_fd == -2) {
+    dtlb_misses_fd = perf_counter_open(
+        PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    page_faults_fd =
+        perf_counter_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+  }
+  long long dtlb_misses = perf_counter_read(dtlb_misses_fd);
+  long long page_faults = perf_counter_read(page_faults_fd);
+  if (sign < 0) {
+    stats.dtlb_misses = dtlb_misses < 0 ? -1 : -dtlb_misses;
+    stats.page_faults = page_faults < 0 ? -1 : -page_faults;
+  } else {
+    stats.dtlb_misses = dtlb_misses < 0 ? -1 : stats.dtlb_misses + dtlb_misses;
+    stats.page_faults = page_faults < 0 ? -1 : stats.page_faults + page_faults;
+  }
+#else
+  stats.dtlb_misses = stats.page_faults = -1;
+#endif
+}
+
+// [Binary trace]
+//
+// With ENABLE_MALLOC_TRACE, every malloc / free / mmap / munmap is appended
+// to a buffer of fixed-size records that is written out only when it fills
+// up, so the full-size workload can be traced. The file is a
+// trace_file_header_t followed by trace_record_t's. Convert one to the
+// visualizer's text format with trace/bintrace2text.bin.
+
+#define TRACE_MAGIC "MCTR"
+#define TRACE_VERSION 1
+#define TRACE_BUFFER_RECORDS (64 * 1024)
+
+typedef struct trace_file_header_t {
+  char magic[4];
+  uint32_t version;
+} trace_file_header_t;
+
+typedef struct trace_record_t {
+  uint64_t ptr;
+  uint32_t size;
+  uint32_t op;  // 'a', 'f', 'm' or 'u'
+} trace_record_t;
+
+trace_record_t *trace_buffer;
+size_t trace_buffer_used;
+
+void flush_trace_buffer() {
+  if (trace_buffer_used &&
+      fwrite(trace_buffer, sizeof(trace_record_t), trace_buffer_used,
+             trace_fp) != trace_buffer_used) {
+    fprintf(stderr, "Failed to write a trace file\n");
+    exit(EXIT_FAILURE);
+  }
+  trace_buffer_used = 0;
+}
+
+static inline void trace_record(char op, void *ptr, size_t size) {
+  if (!trace_fp) {
+    return;
+  }
+  if (trace_buffer_used == TRACE_BUFFER_RECORDS) {
+    flush_trace_buffer();
+  }
+  assert(size <= UINT32_MAX);
+  trace_record_t *record = &trace_buffer[trace_buffer_used++];
+  record->ptr = (uint64_t)(uintptr_t)ptr;
+  record->size = (uint32_t)size;
+  record->op = (uint32_t)op;
+}
+
+void open_trace_file(const char *trace_file_name) {
   trace_fp = NULL;
 #ifdef ENABLE_MALLOC_TRACE
   if (trace_file_name) {
@@ -163,25 +384,48 @@ void run_challenge(const char *trace_file_name, size_t min_size,
       fprintf(stderr, "Failed to open a trace file: %s\n", trace_file_name);
       exit(EXIT_FAILURE);
     }
+    trace_file_header_t header = {TRACE_MAGIC, TRACE_VERSION};
+    fwrite(&header, sizeof(header), 1, trace_fp);
+    if (!trace_buffer) {
+      trace_buffer = (trace_record_t *)malloc(TRACE_BUFFER_RECORDS *
+                                              sizeof(trace_record_t));
+    }
+    trace_buffer_used = 0;
   }
-  const int epochs_per_cycle = 10;
-  const int objects_per_epoch_small = 25;
-  const int objects_per_epoch_large = 50;
-#else
-  const int epochs_per_cycle = 100;
-  const int objects_per_epoch_small = 100;
-  const int objects_per_epoch_large = 2000;
 #endif
-  const int cycles = 10;
+}
+
+void close_trace_file() {
+  if (trace_fp) {
+    flush_trace_buffer();
+    fclose(trace_fp);
+    trace_fp = NULL;
+  }
+}
+
+// Run one challenge.
+// |min_size|: The min size of an allocated object
+// |max_size|: The max size of an allocated object
+// |*_func|: Function pointers to initialize / malloc / free.
+void run_challenge(const char *trace_file_name, size_t min_size,
+                   size_t max_size, initialize_func_t initialize_func,
+                   malloc_func_t malloc_func, free_func_t free_func,
+                   finalize_func_t finalize_func) {
+  open_trace_file(trace_file_name);
+  const int epochs_per_cycle = EPOCHS_PER_CYCLE;
+  const int objects_per_epoch_small = OBJECTS_PER_EPOCH_SMALL;
+  const int objects_per_epoch_large = OBJECTS_PER_EPOCH_LARGE;
+  const int cycles = CYCLES;
   char tag = 0;
   // The last entry of the vector is used to store objects that are never freed.
   vector_t *objects[epochs_per_cycle + 1];
   for (int i = 0; i < epochs_per_cycle + 1; i++) {
     objects[i] = vector_create();
   }
+  begin_epoch_samples();
   initialize_func();
-  stats.mmap_size = stats.munmap_size = 0;
-  stats.allocated_size = stats.freed_size = 0;
+  reset_stats();
+  sample_perf_counters(-1);
   stats.begin_time = get_time();
   for (int cycle = 0; cycle < cycles; cycle++) {
     for (int epoch = 0; epoch < epochs_per_cycle; epoch++) {
@@ -201,9 +445,7 @@ void run_challenge(const char *trace_file_name, size_t min_size,
         stats.allocated_size += size;
         allocated += size;
         void *ptr = malloc_func(size);
-        if (trace_fp) {
-          fprintf(trace_fp, "a %llu %ld\n", (unsigned long long)ptr, size);
-        }
+        trace_record('a', ptr, size);
         memset(ptr, tag, size);
         object_t object = {ptr, size, tag};
         tag++;
@@ -232,42 +474,422 @@ void run_challenge(const char *trace_file_name, size_t min_size,
           printf("An allocated object is broken!");
           assert(0);
         }
-        if (trace_fp) {
-          fprintf(trace_fp, "f %llu %ld\n", (unsigned long long)object.ptr,
-                  object.size);
-        }
+        trace_record('f', object.ptr, object.size);
         free_func(object.ptr);
       }
 
-#if 0
-      // Debug print
-      printf("epoch = %d, allocated = %ld bytes, freed = %ld bytes\n",
-             cycle * epochs_per_cycle + epoch, allocated, freed);
-      printf("allocated = %.2f MB, freed = %.2f MB, mmap = %.2f MB, munmap = %.2f MB, utilization = %d%%\n",
-             stats.allocated_size / 1024.0 / 1024.0,
-             stats.freed_size / 1024.0 / 1024.0,
-             stats.mmap_size / 1024.0 / 1024.0,
-             stats.munmap_size / 1024.0 / 1024.0,
-             (int)(100.0 * (stats.allocated_size - stats.freed_size)
-                   / (stats.mmap_size - stats.munmap_size)));
-#endif
+      record_epoch_sample(stats.allocated_size - stats.freed_size);
       vector_clear(vector);
     }
   }
   stats.end_time = get_time();
+  sample_perf_counters(1);
+  end_epoch_samples();
   for (int i = 0; i < epochs_per_cycle + 1; i++) {
     vector_destroy(objects[i]);
   }
+  // The score is taken at the end of the timed region, what finalize_func
+  // gives back doesn't count.
+  stats_t end_stats = stats;
   finalize_func();
-  if (trace_fp) {
-    fclose(trace_fp);
-    trace_fp = NULL;
+  stats = end_stats;
+  close_trace_file();
+}
+
+// [Pre-generated workloads]
+//
+// With --replay, the op stream of a challenge (sizes, lifetimes and free
+// order) is generated up front, outside the timed region, and then replayed
+// for both allocators. Only the allocator calls and a one-byte tag at both ends
+// of each object remain in the timed loop. The stream can be written to /
+// read from a file (--workload-out / --workload-in) so that every allocator
+// and every build sees byte-for-byte the same workload.
+
+// One op of a workload, 8 bytes.
+typedef struct workload_op_t {
+  uint32_t size;    // The size for an allocation, 0 for a free or an epoch mark.
+  uint32_t object;  // The index of the object, or WORKLOAD_EPOCH_MARK.
+} workload_op_t;
+
+#define WORKLOAD_EPOCH_MARK UINT32_MAX
+#define WORKLOAD_MAGIC "MCWL"
+#define WORKLOAD_VERSION 1
+
+typedef struct workload_t {
+  size_t size;
+  size_t capacity;
+  workload_op_t *ops;
+  size_t objects;  // The number of allocations (= object indices in use).
+  size_t allocated_size;
+  size_t freed_size;
+} workload_t;
+
+// The header of a workload file, followed by |ops| workload_op_t.
+typedef struct workload_file_header_t {
+  char magic[4];
+  uint32_t version;
+  uint64_t ops;
+  uint64_t objects;
+  uint64_t allocated_size;
+  uint64_t freed_size;
+} workload_file_header_t;
+
+int replay_mode;
+const char *workload_in_prefix;
+const char *workload_out_prefix;
+
+// [Burst latency]
+//
+// With --burst-latency, every malloc of the peak epochs (epoch 0 of each
+// cycle, OBJECTS_PER_EPOCH_LARGE objects) is timed on its own, into a
+// preallocated array, and the distribution is printed after the challenge:
+// for simple_malloc, my_malloc, and my_malloc with my_reserve() called at the
+// end of the epoch before each peak (and my_release_reserve() at the end of
+// the peak). The reserve calls are inside the timed region but not in the
+// latencies.
+
+int burst_latency_mode;
+int burst_use_reserve;
+// The bytes allocated in the peak epoch of each cycle, plus a header guess.
+size_t burst_reserve_size[CYCLES];
+// [ns], NULL when not measuring.
+uint32_t *burst_latencies;
+size_t burst_latency_count;
+
+typedef struct burst_stats_t {
+  size_t count;
+  double total_ms;
+  double p50_us;
+  double p99_us;
+  double p999_us;
+  double max_us;
+} burst_stats_t;
+
+// Of the last replay_challenge().
+burst_stats_t burst_stats;
+
+void begin_burst_latencies(const workload_t *workload) {
+  burst_latency_count = 0;
+  burst_latencies = NULL;
+  if (!burst_latency_mode) {
+    return;
+  }
+  burst_latencies = (uint32_t *)malloc(workload->objects * sizeof(uint32_t));
+  memset(burst_reserve_size, 0, sizeof(burst_reserve_size));
+  size_t epoch = 0;
+  for (size_t i = 0; i < workload->size && epoch < CYCLES * EPOCHS_PER_CYCLE;
+       i++) {
+    workload_op_t op = workload->ops[i];
+    if (op.size && epoch % EPOCHS_PER_CYCLE == 0) {
+      burst_reserve_size[epoch / EPOCHS_PER_CYCLE] += op.size + 32;
+    } else if (op.object == WORKLOAD_EPOCH_MARK) {
+      epoch++;
+    }
+  }
+}
+
+// Called at every epoch mark, |epoch| is the number of epochs done.
+void burst_epoch_done(size_t epoch) {
+  if (!burst_use_reserve) {
+    return;
+  }
+  if (epoch % EPOCHS_PER_CYCLE == 1) {
+    my_release_reserve();
+  } else if (epoch % EPOCHS_PER_CYCLE == 0 &&
+             epoch / EPOCHS_PER_CYCLE < CYCLES) {
+    my_reserve(burst_reserve_size[epoch / EPOCHS_PER_CYCLE]);
+  }
+}
+
+int compare_uint32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+burst_stats_t end_burst_latencies() {
+  burst_stats_t burst = {0};
+  if (!burst_latencies) {
+    return burst;
+  }
+  burst.count = burst_latency_count;
+  if (burst.count) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < burst.count; i++) {
+      total += burst_latencies[i];
+    }
+    qsort(burst_latencies, burst.count, sizeof(uint32_t), compare_uint32);
+    burst.total_ms = total * 1e-6;
+    burst.p50_us = burst_latencies[burst.count / 2] * 1e-3;
+    burst.p99_us = burst_latencies[burst.count * 99 / 100] * 1e-3;
+    burst.p999_us = burst_latencies[burst.count * 999 / 1000] * 1e-3;
+    burst.max_us = burst_latencies[burst.count - 1] * 1e-3;
+  }
+  free(burst_latencies);
+  burst_latencies = NULL;
+  return burst;
+}
+
+void workload_push(workload_t *workload, uint32_t size, uint32_t object) {
+  if (workload->size >= workload->capacity) {
+    workload->capacity = workload->capacity * 2 + 1024;
+    workload->ops = (workload_op_t *)realloc(
+        workload->ops, workload->capacity * sizeof(workload_op_t));
+  }
+  workload_op_t op = {size, object};
+  workload->ops[workload->size] = op;
+  workload->size++;
+}
+
+void workload_destroy(workload_t *workload) {
+  free(workload->ops);
+  free(workload);
+}
+
+// Generate the op stream run_challenge() would run, with the same
+// distributions.
+workload_t *workload_generate(size_t min_size, size_t max_size) {
+  workload_t *workload = (workload_t *)calloc(1, sizeof(workload_t));
+  // Object indices waiting to be freed at each epoch (the last entry: never).
+  uint32_t *pending[EPOCHS_PER_CYCLE + 1];
+  size_t pending_size[EPOCHS_PER_CYCLE + 1];
+  size_t pending_capacity[EPOCHS_PER_CYCLE + 1];
+  uint32_t *sizes = NULL;
+  size_t sizes_capacity = 0;
+  for (int i = 0; i < EPOCHS_PER_CYCLE + 1; i++) {
+    pending[i] = NULL;
+    pending_size[i] = pending_capacity[i] = 0;
+  }
+  for (int cycle = 0; cycle < CYCLES; cycle++) {
+    for (int epoch = 0; epoch < EPOCHS_PER_CYCLE; epoch++) {
+      int objects_per_epoch =
+          epoch == 0 ? OBJECTS_PER_EPOCH_LARGE : OBJECTS_PER_EPOCH_SMALL;
+      for (int i = 0; i < objects_per_epoch; i++) {
+        size_t size = get_object_size(min_size, max_size);
+        int lifetime = get_object_lifetime(1, EPOCHS_PER_CYCLE);
+        uint32_t object = workload->objects++;
+        if (workload->objects > sizes_capacity) {
+          sizes_capacity = sizes_capacity * 2 + 1024;
+          sizes = (uint32_t *)realloc(sizes, sizes_capacity * sizeof(uint32_t));
+        }
+        sizes[object] = size;
+        workload->allocated_size += size;
+        workload_push(workload, size, object);
+        int target = urand() < 0.04 ? EPOCHS_PER_CYCLE
+                                    : (epoch + lifetime) % EPOCHS_PER_CYCLE;
+        if (pending_size[target] >= pending_capacity[target]) {
+          pending_capacity[target] = pending_capacity[target] * 2 + 128;
+          pending[target] = (uint32_t *)realloc(
+              pending[target], pending_capacity[target] * sizeof(uint32_t));
+        }
+        pending[target][pending_size[target]++] = object;
+      }
+      for (size_t i = 0; i < pending_size[epoch]; i++) {
+        workload->freed_size += sizes[pending[epoch][i]];
+        workload_push(workload, 0, pending[epoch][i]);
+      }
+      pending_size[epoch] = 0;
+      workload_push(workload, 0, WORKLOAD_EPOCH_MARK);
+    }
+  }
+  for (int i = 0; i < EPOCHS_PER_CYCLE + 1; i++) {
+    free(pending[i]);
+  }
+  free(sizes);
+  return workload;
+}
+
+void workload_save(const workload_t *workload, const char *file_name) {
+  FILE *fp = fopen(file_name, "wb");
+  if (!fp) {
+    fprintf(stderr, "Failed to open a workload file: %s\n", file_name);
+    exit(EXIT_FAILURE);
+  }
+  workload_file_header_t header;
+  memcpy(header.magic, WORKLOAD_MAGIC, 4);
+  header.version = WORKLOAD_VERSION;
+  header.ops = workload->size;
+  header.objects = workload->objects;
+  header.allocated_size = workload->allocated_size;
+  header.freed_size = workload->freed_size;
+  if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+      fwrite(workload->ops, sizeof(workload_op_t), workload->size, fp) !=
+          workload->size) {
+    fprintf(stderr, "Failed to write a workload file: %s\n", file_name);
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+}
+
+// Files can be written by hand or by trace/tracemodel.bin, so check that
+// replay_challenge() can run it: every object is allocated once (with a size
+// the challenges use) and freed at most once, after that.
+void workload_validate(const workload_t *workload, const char *file_name) {
+  // 0: not allocated yet, 1: live, 2: freed.
+  uint8_t *state = (uint8_t *)calloc(workload->objects, 1);
+  size_t allocated_size = 0, freed_size = 0;
+  uint32_t *sizes = (uint32_t *)malloc(workload->objects * sizeof(uint32_t));
+  for (size_t i = 0; i < workload->size; i++) {
+    workload_op_t op = workload->ops[i];
+    const char *error = NULL;
+    if (op.object == WORKLOAD_EPOCH_MARK) {
+      if (op.size) error = "an epoch mark with a size";
+    } else if (op.object >= workload->objects) {
+      error = "an object index out of range";
+    } else if (op.size) {
+      if (op.size % 8 || op.size > 4000) {
+        error = "a size that is not a multiple of 8 in [8, 4000]";
+      } else if (state[op.object]) {
+        error = "an object allocated twice";
+      } else {
+        state[op.object] = 1;
+        sizes[op.object] = op.size;
+        allocated_size += op.size;
+      }
+    } else if (state[op.object] != 1) {
+      error = state[op.object] ? "an object freed twice"
+                               : "an object freed before it is allocated";
+    } else {
+      state[op.object] = 2;
+      freed_size += sizes[op.object];
+    }
+    if (error) {
+      fprintf(stderr, "Bad workload file: %s: op %zu: %s\n", file_name, i,
+              error);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (allocated_size != workload->allocated_size ||
+      freed_size != workload->freed_size) {
+    fprintf(stderr,
+            "Bad workload file: %s: allocated/freed bytes don't match the "
+            "header\n",
+            file_name);
+    exit(EXIT_FAILURE);
   }
+  free(state);
+  free(sizes);
+}
+
+workload_t *workload_load(const char *file_name) {
+  FILE *fp = fopen(file_name, "rb");
+  if (!fp) {
+    fprintf(stderr, "Failed to open a workload file: %s\n", file_name);
+    exit(EXIT_FAILURE);
+  }
+  workload_file_header_t header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, WORKLOAD_MAGIC, 4) != 0 ||
+      header.version != WORKLOAD_VERSION) {
+    fprintf(stderr, "Not a workload file: %s\n", file_name);
+    exit(EXIT_FAILURE);
+  }
+  workload_t *workload = (workload_t *)calloc(1, sizeof(workload_t));
+  workload->size = workload->capacity = header.ops;
+  workload->objects = header.objects;
+  workload->allocated_size = header.allocated_size;
+  workload->freed_size = header.freed_size;
+  workload->ops =
+      (workload_op_t *)malloc(workload->capacity * sizeof(workload_op_t));
+  if (fread(workload->ops, sizeof(workload_op_t), workload->size, fp) !=
+      workload->size) {
+    fprintf(stderr, "Truncated workload file: %s\n", file_name);
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+  workload_validate(workload, file_name);
+  return workload;
+}
+
+// Run one challenge by replaying |workload|.
+void replay_challenge(const char *trace_file_name, const workload_t *workload,
+                      initialize_func_t initialize_func,
+                      malloc_func_t malloc_func, free_func_t free_func,
+                      finalize_func_t finalize_func) {
+  open_trace_file(trace_file_name);
+  object_t *objects = (object_t *)calloc(workload->objects, sizeof(object_t));
+  begin_epoch_samples();
+  begin_burst_latencies(workload);
+  if (epoch_samples) {
+    // The live size at each epoch mark is known up front.
+    size_t live_size = 0;
+    size_t epoch = 0;
+    for (size_t i = 0; i < workload->size; i++) {
+      workload_op_t op = workload->ops[i];
+      if (op.size) {
+        live_size += op.size;
+        objects[op.object].size = op.size;
+      } else if (op.object != WORKLOAD_EPOCH_MARK) {
+        live_size -= objects[op.object].size;
+      } else if (epoch < CYCLES * EPOCHS_PER_CYCLE) {
+        epoch_samples[epoch++].live_size = live_size;
+      }
+    }
+  }
+  size_t epoch = 0;
+  initialize_func();
+  reset_stats();
+  stats.allocated_size = workload->allocated_size;
+  stats.freed_size = workload->freed_size;
+  sample_perf_counters(-1);
+  stats.begin_time = get_time();
+  burst_epoch_done(0);
+  for (size_t i = 0; i < workload->size; i++) {
+    workload_op_t op = workload->ops[i];
+    if (op.size) {
+      void *ptr;
+      if (burst_latencies && epoch % EPOCHS_PER_CYCLE == 0) {
+        uint64_t begin = get_time_ns();
+        ptr = malloc_func(op.size);
+        burst_latencies[burst_latency_count++] = get_time_ns() - begin;
+      } else {
+        ptr = malloc_func(op.size);
+      }
+      trace_record('a', ptr, op.size);
+      // Same tags as run_challenge(), skipping 0.
+      char tag = (char)(op.object % 255 + 1);
+      ((char *)ptr)[0] = tag;
+      ((char *)ptr)[op.size - 1] = tag;
+      object_t object = {ptr, op.size, tag};
+      objects[op.object] = object;
+    } else if (op.object != WORKLOAD_EPOCH_MARK) {
+      object_t object = objects[op.object];
+      if (((char *)object.ptr)[0] != object.tag ||
+          ((char *)object.ptr)[object.size - 1] != object.tag) {
+        printf("An allocated object is broken!");
+        assert(0);
+      }
+      trace_record('f', object.ptr, object.size);
+      free_func(object.ptr);
+    } else {
+      if (epoch_samples && epoch < CYCLES * EPOCHS_PER_CYCLE) {
+        record_epoch_sample(epoch_samples[epoch].live_size);
+      }
+      epoch++;
+      burst_epoch_done(epoch);
+    }
+  }
+  stats.end_time = get_time();
+  sample_perf_counters(1);
+  end_epoch_samples();
+  burst_stats = end_burst_latencies();
+  free(objects);
+  // As in run_challenge().
+  stats_t end_stats = stats;
+  finalize_func();
+  stats = end_stats;
+  close_trace_file();
 }
 
 #define FIRST_CHALLENGE_INDEX 1
 #define LAST_CHALLENGE_INDEX 5
 
+// Skip simple_malloc (its column shows "-") and/or every challenge but
+// |only_challenge| (0 = all), to make repeated runs cheaper. Skipped runs
+// don't consume rand(), so the op streams after them differ from a full run;
+// use --workload-in to compare such runs with each other.
+int my_only;
+int only_challenge;
+
 int my_malloc_time_ms[LAST_CHALLENGE_INDEX + 1];
 int my_malloc_utilization_percentage[LAST_CHALLENGE_INDEX + 1];
 
@@ -284,19 +906,52 @@ void print_stats(int challenge_index, stats_t simple_stats, stats_t my_stats) {
   int my_time_ms = (my_stats.end_time - my_stats.begin_time) * 1000;
   int simple_utilization_percentage =
       (int)(100.0 * (simple_stats.allocated_size - simple_stats.freed_size) /
-            (simple_stats.mmap_size - simple_stats.munmap_size));
+            (simple_stats.mmap_size - simple_stats.munmap_size -
+             simple_stats.purge_size));
   int my_utilization_percentage =
       (int)(100.0 * (my_stats.allocated_size - my_stats.freed_size) /
-            (my_stats.mmap_size - my_stats.munmap_size));
+            (my_stats.mmap_size - my_stats.munmap_size - my_stats.purge_size));
 
-  printf("%16s| %15d => %15d\n", "Time [ms]", simple_time_ms, my_time_ms);
-  printf("%16s| %15d => %15d\n", "Utilization [%] ",
-         simple_utilization_percentage, my_utilization_percentage);
+  if (my_only) {
+    printf("%16s| %15s => %15d\n", "Time [ms]", "-", my_time_ms);
+    printf("%16s| %15s => %15d\n", "Utilization [%] ", "-",
+           my_utilization_percentage);
+  } else {
+    printf("%16s| %15d => %15d\n", "Time [ms]", simple_time_ms, my_time_ms);
+    printf("%16s| %15d => %15d\n", "Utilization [%] ",
+           simple_utilization_percentage, my_utilization_percentage);
+  }
+#ifdef ENABLE_PERF_COUNTERS
+  printf("%16s| %15lld => %15lld\n", "dTLB misses", simple_stats.dtlb_misses,
+         my_stats.dtlb_misses);
+  printf("%16s| %15lld => %15lld\n", "Page faults", simple_stats.page_faults,
+         my_stats.page_faults);
+#endif
 
   my_malloc_time_ms[challenge_index] = my_time_ms;
   my_malloc_utilization_percentage[challenge_index] = my_utilization_percentage;
 }
 
+void print_burst_stats(const char *name, burst_stats_t burst) {
+  printf("%-16s| %8zu %10.1f %8.2f %8.2f %8.2f %9.1f\n", name, burst.count,
+         burst.total_ms, burst.p50_us, burst.p99_us, burst.p999_us,
+         burst.max_us);
+}
+
+// The peak epoch malloc latencies of one challenge, see [Burst latency].
+void print_burst_latency(burst_stats_t simple_burst, burst_stats_t my_burst,
+                         burst_stats_t reserve_burst) {
+  printf("%-16s| %8s %10s %8s %8s %8s %9s\n", "Peak epoch", "mallocs",
+         "total [ms]", "p50 [us]", "p99 [us]", "p999[us]", "max [us]");
+  if (!my_only) {
+    print_burst_stats("simple_malloc", simple_burst);
+  }
+  print_burst_stats("my_malloc", my_burst);
+  if (my_reserve) {
+    print_burst_stats("  + my_reserve", reserve_burst);
+  }
+}
+
 void print_score_data() {
   printf("\nChallenge done!\n");
   printf("Please copy & paste the following data in the score sheet!\n");
@@ -306,10 +961,83 @@ void print_score_data() {
   printf("\n");
 }
 
+// Run challenge |challenge_index| with both allocators and print the stats.
+void run_challenge_pair(int challenge_index, size_t min_size, size_t max_size) {
+  if (only_challenge && only_challenge != challenge_index) {
+    return;
+  }
+  stats_t simple_stats = {0}, my_stats;
+  char simple_trace[64], my_trace[64];
+  snprintf(simple_trace, sizeof(simple_trace), "trace%d_simple.trace",
+           challenge_index);
+  snprintf(my_trace, sizeof(my_trace), "trace%d_my.trace", challenge_index);
+  char simple_epoch_stats[256], my_epoch_stats[256];
+  if (epoch_stats_prefix) {
+    snprintf(simple_epoch_stats, sizeof(simple_epoch_stats), "%s%d_simple.csv",
+             epoch_stats_prefix, challenge_index);
+    snprintf(my_epoch_stats, sizeof(my_epoch_stats), "%s%d_my.csv",
+             epoch_stats_prefix, challenge_index);
+  }
+  if (!replay_mode) {
+    if (!my_only) {
+      epoch_stats_file_name = epoch_stats_prefix ? simple_epoch_stats : NULL;
+      run_challenge(simple_trace, min_size, max_size, simple_initialize,
+                    simple_malloc, simple_free, simple_finalize);
+      simple_stats = stats;
+    }
+    epoch_stats_file_name = epoch_stats_prefix ? my_epoch_stats : NULL;
+    run_challenge(my_trace, min_size, max_size, my_initialize, my_malloc,
+                  my_free, my_finalize);
+    my_stats = stats;
+    epoch_stats_file_name = NULL;
+    print_stats(challenge_index, simple_stats, my_stats);
+    return;
+  }
+  char workload_file[256];
+  workload_t *workload;
+  if (workload_in_prefix) {
+    snprintf(workload_file, sizeof(workload_file), "%s%d.wl",
+             workload_in_prefix, challenge_index);
+    workload = workload_load(workload_file);
+  } else {
+    workload = workload_generate(min_size, max_size);
+  }
+  if (workload_out_prefix) {
+    snprintf(workload_file, sizeof(workload_file), "%s%d.wl",
+             workload_out_prefix, challenge_index);
+    workload_save(workload, workload_file);
+  }
+  burst_stats_t simple_burst = {0}, my_burst, reserve_burst = {0};
+  if (!my_only) {
+    epoch_stats_file_name = epoch_stats_prefix ? simple_epoch_stats : NULL;
+    replay_challenge(simple_trace, workload, simple_initialize, simple_malloc,
+                     simple_free, simple_finalize);
+    simple_stats = stats;
+    simple_burst = burst_stats;
+  }
+  epoch_stats_file_name = epoch_stats_prefix ? my_epoch_stats : NULL;
+  replay_challenge(my_trace, workload, my_initialize, my_malloc, my_free,
+                   my_finalize);
+  my_stats = stats;
+  my_burst = burst_stats;
+  epoch_stats_file_name = NULL;
+  if (burst_latency_mode && my_reserve) {
+    // Not traced and not in the score, only for the latencies.
+    burst_use_reserve = 1;
+    replay_challenge(NULL, workload, my_initialize, my_malloc, my_free,
+                     my_finalize);
+    burst_use_reserve = 0;
+    reserve_burst = burst_stats;
+  }
+  workload_destroy(workload);
+  print_stats(challenge_index, simple_stats, my_stats);
+  if (burst_latency_mode) {
+    print_burst_latency(simple_burst, my_burst, reserve_burst);
+  }
+}
+
 // Run challenges
 void run_challenges() {
-  stats_t simple_stats, my_stats;
-
 #ifdef ENABLE_MALLOC_TRACE
   printf(
       "!!! WARNING - MALLOC_TRACE is enabled.\n"
@@ -320,50 +1048,11 @@ void run_challenges() {
   run_challenge(NULL, 128, 128, simple_initialize, simple_malloc, simple_free,
                 simple_finalize);
 
-  // Challenge 1:
-  run_challenge("trace1_simple.txt", 128, 128, simple_initialize, simple_malloc,
-                simple_free, simple_finalize);
-  simple_stats = stats;
-  run_challenge("trace1_my.txt", 128, 128, my_initialize, my_malloc, my_free,
-                my_finalize);
-  my_stats = stats;
-  print_stats(1, simple_stats, my_stats);
-
-  // Challenge 2:
-  run_challenge("trace2_simple.txt", 16, 16, simple_initialize, simple_malloc,
-                simple_free, simple_finalize);
-  simple_stats = stats;
-  run_challenge("trace2_my.txt", 16, 16, my_initialize, my_malloc, my_free,
-                my_finalize);
-  my_stats = stats;
-  print_stats(2, simple_stats, my_stats);
-
-  // Challenge 3:
-  run_challenge("trace3_simple.txt", 16, 128, simple_initialize, simple_malloc,
-                simple_free, simple_finalize);
-  simple_stats = stats;
-  run_challenge("trace3_my.txt", 16, 128, my_initialize, my_malloc, my_free,
-                my_finalize);
-  my_stats = stats;
-  print_stats(3, simple_stats, my_stats);
-
-  // Challenge 4:
-  run_challenge("trace4_simple.txt", 256, 4000, simple_initialize,
-                simple_malloc, simple_free, simple_finalize);
-  simple_stats = stats;
-  run_challenge("trace4_my.txt", 256, 4000, my_initialize, my_malloc, my_free,
-                my_finalize);
-  my_stats = stats;
-  print_stats(4, simple_stats, my_stats);
-
-  // Challenge 5:
-  run_challenge("trace5_simple.txt", 8, 4000, simple_initialize, simple_malloc,
-                simple_free, simple_finalize);
-  simple_stats = stats;
-  run_challenge("trace5_my.txt", 8, 4000, my_initialize, my_malloc, my_free,
-                my_finalize);
-  my_stats = stats;
-  print_stats(5, simple_stats, my_stats);
+  run_challenge_pair(1, 128, 128);
+  run_challenge_pair(2, 16, 16);
+  run_challenge_pair(3, 16, 128);
+  run_challenge_pair(4, 256, 4000);
+  run_challenge_pair(5, 8, 4000);
 
 #ifdef ENABLE_MALLOC_TRACE
   printf(
@@ -376,17 +1065,195 @@ void run_challenges() {
 #endif
 }
 
+//
+// [Producer/consumer benchmark]
+//
+// The owner thread allocates objects and hands them to a consumer thread
+// through a ring buffer; the consumer checks and frees them. "lock" takes one
+// global mutex around every my_malloc / my_free (the consumer calls my_free),
+// "remote" doesn't lock at all: the consumer calls my_free_remote and the
+// owner drains those frees on its allocation misses.
+
+#define PC_RING_SIZE 4096
+#define PC_MAX_SIZE 512
+
+typedef struct pc_ring_t {
+  // Each index on its own cache line, so that only the slots move between
+  // the threads.
+  _Alignas(64) _Atomic size_t head;  // Written by the consumer.
+  _Alignas(64) _Atomic size_t tail;  // Written by the producer.
+  _Alignas(64) void *slots[PC_RING_SIZE];
+} pc_ring_t;
+
+typedef struct pc_bench_t {
+  pc_ring_t ring;
+  size_t ops;
+  const uint32_t *sizes;
+  int use_lock;
+  pthread_mutex_t lock;
+  size_t contended_locks;  // pthread_mutex_trylock failed first.
+  long long cache_misses;  // Both threads, -1 without perf counters.
+} pc_bench_t;
+
+void pc_lock(pc_bench_t *bench, size_t *contended) {
+  if (pthread_mutex_trylock(&bench->lock) != 0) {
+    (*contended)++;
+    pthread_mutex_lock(&bench->lock);
+  }
+}
+
+// Measured per thread, since perf_counter_open() only counts the caller.
+int pc_perf_open() {
+#ifdef ENABLE_PERF_COUNTERS
+  return perf_counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+#else
+  return -1;
+#endif
+}
+
+long long pc_perf_close(int fd) {
+#ifdef ENABLE_PERF_COUNTERS
+  long long value = perf_counter_read(fd);
+  if (fd >= 0) close(fd);
+  return value;
+#else
+  return -1;
+#endif
+}
+
+void pc_add_cache_misses(pc_bench_t *bench, long long misses) {
+  pthread_mutex_lock(&bench->lock);
+  if (misses < 0 || bench->cache_misses < 0) {
+    bench->cache_misses = -1;
+  } else {
+    bench->cache_misses += misses;
+  }
+  pthread_mutex_unlock(&bench->lock);
+}
+
+void *pc_producer(void *arg) {
+  pc_bench_t *bench = (pc_bench_t *)arg;
+  pc_ring_t *ring = &bench->ring;
+  size_t contended = 0;
+  int fd = pc_perf_open();
+  for (size_t i = 0; i < bench->ops; i++) {
+    uint32_t size = bench->sizes[i];
+    void *ptr;
+    if (bench->use_lock) {
+      pc_lock(bench, &contended);
+      ptr = my_malloc(size);
+      pthread_mutex_unlock(&bench->lock);
+    } else {
+      ptr = my_malloc(size);
+    }
+    // Tag both ends like the challenges do, so the consumer touches them.
+    ((char *)ptr)[0] = ((char *)ptr)[size - 1] = (char)(i | 1);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) ==
+           PC_RING_SIZE) {
+      sched_yield();
+    }
+    ring->slots[tail % PC_RING_SIZE] = ptr;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  }
+  pc_add_cache_misses(bench, pc_perf_close(fd));
+  pthread_mutex_lock(&bench->lock);
+  bench->contended_locks += contended;
+  pthread_mutex_unlock(&bench->lock);
+  return NULL;
+}
+
+void *pc_consumer(void *arg) {
+  pc_bench_t *bench = (pc_bench_t *)arg;
+  pc_ring_t *ring = &bench->ring;
+  size_t contended = 0;
+  int fd = pc_perf_open();
+  for (size_t i = 0; i < bench->ops; i++) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (atomic_load_explicit(&ring->tail, memory_order_acquire) == head) {
+      sched_yield();
+    }
+    char *ptr = (char *)ring->slots[head % PC_RING_SIZE];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    uint32_t size = bench->sizes[i];
+    if (ptr[0] != (char)(i | 1) || ptr[size - 1] != (char)(i | 1)) {
+      printf("An allocated object is broken!");
+      assert(0);
+    }
+    if (bench->use_lock) {
+      pc_lock(bench, &contended);
+      my_free(ptr);
+      pthread_mutex_unlock(&bench->lock);
+    } else {
+      my_free_remote(ptr);
+    }
+  }
+  pc_add_cache_misses(bench, pc_perf_close(fd));
+  pthread_mutex_lock(&bench->lock);
+  bench->contended_locks += contended;
+  pthread_mutex_unlock(&bench->lock);
+  return NULL;
+}
+
+// Run |ops| objects through the producer/consumer pair in both modes.
+void run_producer_consumer(size_t ops) {
+  uint32_t *sizes = (uint32_t *)malloc(ops * sizeof(uint32_t));
+  for (size_t i = 0; i < ops; i++) {
+    sizes[i] = ((uint32_t)(urand() * (PC_MAX_SIZE / 8)) + 1) * 8;
+  }
+  printf("Producer/consumer: %zu objects of 8-%d bytes, ring of %d\n", ops,
+         PC_MAX_SIZE, PC_RING_SIZE);
+  if (!my_free_remote || !my_remote_drains) {
+    printf("(no my_free_remote, only the lock mode runs)\n");
+  }
+  printf("%-8s| %10s | %12s | %15s | %12s | %12s\n", "mode", "Time [ms]",
+         "Mops/s", "contended locks", "drains", "cache misses");
+  for (int use_lock = 1; use_lock >= (my_free_remote && my_remote_drains ? 0 : 1);
+       use_lock--) {
+    pc_bench_t *bench = (pc_bench_t *)aligned_alloc(64, sizeof(pc_bench_t));
+    memset(bench, 0, sizeof(*bench));
+    bench->ops = ops;
+    bench->sizes = sizes;
+    bench->use_lock = use_lock;
+    pthread_mutex_init(&bench->lock, NULL);
+    my_initialize();
+    pthread_t producer, consumer;
+    double begin_time = get_time();
+    pthread_create(&producer, NULL, pc_producer, bench);
+    pthread_create(&consumer, NULL, pc_consumer, bench);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    double time = get_time() - begin_time;
+    size_t drains = use_lock ? 0 : my_remote_drains();
+    my_finalize();
+    printf("%-8s| %10d | %12.2f | %15zu | %12zu | %12lld\n",
+           use_lock ? "lock" : "remote", (int)(time * 1000),
+           ops / time / 1e6, bench->contended_locks, drains,
+           bench->cache_misses);
+    pthread_mutex_destroy(&bench->lock);
+    free(bench);
+  }
+  free(sizes);
+}
+
+void update_peak_mapped_size() {
+  size_t mapped_size = stats.mmap_size - stats.munmap_size - stats.purge_size;
+  if (mapped_size > stats.peak_mapped_size) {
+    stats.peak_mapped_size = mapped_size;
+  }
+}
+
 // Allocate a memory region from the system. |size| needs to be a multiple of
 // 4096 bytes.
 void *mmap_from_system(size_t size) {
   assert(size % 4096 == 0);
   stats.mmap_size += size;
+  stats.mmap_count++;
+  update_peak_mapped_size();
   void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
   assert(ptr);
-  if (trace_fp) {
-    fprintf(trace_fp, "m %llu %ld\n", (unsigned long long)ptr, size);
-  }
+  trace_record('m', ptr, size);
   return ptr;
 }
 
@@ -396,14 +1263,667 @@ void munmap_to_system(void *ptr, size_t size) {
   assert(size % 4096 == 0);
   assert((uintptr_t)(ptr) % 4096 == 0);
   stats.munmap_size += size;
+  stats.munmap_count++;
   int ret = munmap(ptr, size);
-  if (trace_fp) {
-    fprintf(trace_fp, "u %llu %ld\n", (unsigned long long)ptr, size);
+  trace_record('u', ptr, size);
+  assert(ret != -1);
+}
+
+// Give the physical memory of [ptr, ptr + size) back to the system but keep
+// the mapping. |ptr| and |size| need to be a multiple of 4096 bytes. The
+// contents are undefined afterwards (zero or the old bytes). The range counts
+// as returned until unpurge_from_system() is called for it.
+void purge_to_system(void *ptr, size_t size) {
+  assert(size % 4096 == 0);
+  assert((uintptr_t)(ptr) % 4096 == 0);
+  stats.purge_size += size;
+  stats.purge_count++;
+  int ret = -1;
+#ifdef MADV_FREE
+  ret = madvise(ptr, size, MADV_FREE);
+#endif
+  if (ret == -1) {
+    // Kernels older than 4.5 don't know MADV_FREE.
+    ret = madvise(ptr, size, MADV_DONTNEED);
   }
+  // Traced as an unmap, since that is what it means for the resident size.
+  trace_record('u', ptr, size);
   assert(ret != -1);
 }
 
+// Tell the system a purged range [ptr, ptr + size) is going to be used
+// again. Nothing needs to be done for the mapping itself (pages fault back in
+// on touch), this is for the accounting.
+void unpurge_from_system(void *ptr, size_t size) {
+  assert(size % 4096 == 0);
+  assert((uintptr_t)(ptr) % 4096 == 0);
+  assert(stats.purge_size >= size);
+  stats.purge_size -= size;
+  update_peak_mapped_size();
+  trace_record('m', ptr, size);
+}
+
+// Ask the system to back [ptr, ptr + size) with transparent huge pages. |ptr|
+// and |size| need to be a multiple of 4096 bytes. Returns 0 if the kernel
+// refused (e.g. THP is disabled); the range is still usable as 4096-byte pages.
+int advise_hugepage_to_system(void *ptr, size_t size) {
+  assert(size % 4096 == 0);
+  assert((uintptr_t)(ptr) % 4096 == 0);
+#ifdef MADV_HUGEPAGE
+  return madvise(ptr, size, MADV_HUGEPAGE) == 0;
+#else
+  return 0;
+#endif
+}
+
+//
+// [Aligned allocation / calloc benchmark]
+//
+// A FIFO window of live objects of 8-AL_MAX_SIZE bytes. For each alignment,
+// my_aligned_alloc is compared with what a caller does without it: my_malloc
+// |size + alignment| and round the pointer up (or, when that doesn't fit in
+// my_malloc, mmap_from_system whole pages). Utilization is the requested
+// bytes over the mapped bytes with the window full. Then my_calloc is
+// compared with my_malloc + memset, once growing the heap from empty (every
+// block comes from a fresh page) and once with a FIFO window (mostly reuse).
+
+#define AL_WINDOW 2000
+#define AL_MAX_SIZE 512
+
+typedef struct al_slot_t {
+  void *ptr;   // What to free.
+  size_t size;
+} al_slot_t;
+
+// Run |ops| allocations through the window, |mode| 0: my_aligned_alloc,
+// 1: my_malloc and round up, 2: mmap_from_system.
+void run_aligned_mode(size_t ops, size_t alignment, int mode,
+                      const uint32_t *sizes) {
+  al_slot_t *window = (al_slot_t *)calloc(AL_WINDOW, sizeof(al_slot_t));
+  size_t live = 0, full_live = 0, full_mapped = 0;
+  my_initialize();
+  reset_stats();
+  double begin_time = get_time();
+  for (size_t i = 0; i < ops; i++) {
+    al_slot_t *slot = &window[i % AL_WINDOW];
+    if (slot->ptr) {
+      if (mode == 2) {
+        munmap_to_system(slot->ptr, (slot->size + 4095) & ~(size_t)4095);
+      } else {
+        my_free(slot->ptr);
+      }
+      live -= slot->size;
+    }
+    size_t size = sizes[i];
+    char *ptr;
+    if (mode == 0) {
+      ptr = (char *)my_aligned_alloc(alignment, size);
+      slot->ptr = ptr;
+    } else if (mode == 1) {
+      slot->ptr = my_malloc(size + alignment);
+      ptr = (char *)(((uintptr_t)slot->ptr + alignment - 1) &
+                     ~(uintptr_t)(alignment - 1));
+    } else {
+      ptr = (char *)mmap_from_system((size + 4095) & ~(size_t)4095);
+      slot->ptr = ptr;
+    }
+    assert(ptr && (uintptr_t)ptr % alignment == 0);
+    ptr[0] = ptr[size - 1] = 1;
+    slot->size = size;
+    live += size;
+    if (i == ops - 1 || i == AL_WINDOW - 1) {
+      full_live = live;
+      full_mapped = stats.mmap_size - stats.munmap_size - stats.purge_size;
+    }
+  }
+  double time = get_time() - begin_time;
+  for (size_t i = 0; i < AL_WINDOW; i++) {
+    if (!window[i].ptr) continue;
+    if (mode == 2) {
+      munmap_to_system(window[i].ptr,
+                       (window[i].size + 4095) & ~(size_t)4095);
+    } else {
+      my_free(window[i].ptr);
+    }
+  }
+  my_finalize();
+  static const char *mode_names[] = {"my_aligned_alloc", "my_malloc+align",
+                                     "mmap pages"};
+  printf("%9zu | %-17s| %10d | %15d\n", alignment, mode_names[mode],
+         (int)(time * 1000), (int)(100.0 * full_live / full_mapped));
+  free(window);
+}
+
+// |use_calloc| 1: my_calloc, 0: my_malloc + memset.
+void run_calloc_mode(size_t ops, size_t window_size, int use_calloc,
+                     const uint32_t *sizes) {
+  void **window = (void **)calloc(window_size, sizeof(void *));
+  my_initialize();
+  double begin_time = get_time();
+  for (size_t i = 0; i < ops; i++) {
+    void **slot = &window[i % window_size];
+    if (*slot) my_free(*slot);
+    size_t size = sizes[i];
+    if (use_calloc) {
+      *slot = my_calloc(1, size);
+    } else {
+      *slot = my_malloc(size);
+      memset(*slot, 0, size);
+    }
+    // Touch it like a user of zeroed memory would.
+    assert(((char *)*slot)[size - 1] == 0);
+    ((char *)*slot)[0] = 1;
+  }
+  double time = get_time() - begin_time;
+  for (size_t i = 0; i < window_size; i++) {
+    if (window[i]) my_free(window[i]);
+  }
+  my_finalize();
+  printf("%-6s | %-17s| %10d\n", window_size < ops ? "fifo" : "grow",
+         use_calloc ? "my_calloc" : "my_malloc+memset", (int)(time * 1000));
+  free(window);
+}
+
+void run_aligned_benchmark(size_t ops) {
+  if (!my_aligned_alloc || !my_calloc) {
+    printf("(no my_aligned_alloc / my_calloc)\n");
+    return;
+  }
+  uint32_t *sizes = (uint32_t *)malloc(ops * sizeof(uint32_t));
+  for (size_t i = 0; i < ops; i++) {
+    sizes[i] = ((uint32_t)(urand() * (AL_MAX_SIZE / 8)) + 1) * 8;
+  }
+  printf("Aligned allocation: %zu objects of 8-%d bytes, window of %d\n", ops,
+         AL_MAX_SIZE, AL_WINDOW);
+  printf("%9s | %-17s| %10s | %15s\n", "alignment", "mode", "Time [ms]",
+         "Utilization [%]");
+  static const size_t alignments[] = {64, 4096};
+  for (int a = 0; a < 2; a++) {
+    run_aligned_mode(ops, alignments[a], 0, sizes);
+    // my_malloc only takes up to 4000 bytes.
+    run_aligned_mode(ops, alignments[a],
+                     AL_MAX_SIZE + alignments[a] <= 4000 ? 1 : 2, sizes);
+  }
+  // Bigger objects, that's where zeroing costs.
+  for (size_t i = 0; i < ops; i++) {
+    sizes[i] = ((uint32_t)(urand() * (4000 / 8)) + 1) * 8;
+  }
+  // Growing: as many as fit in ~64 MB.
+  size_t grow_ops = ops < 32000 ? ops : 32000;
+  printf("\nZeroed allocation: 8-4000 bytes, %zu growing the heap, %zu "
+         "through a window of %d\n", grow_ops, ops, AL_WINDOW);
+  printf("%-6s | %-17s| %10s\n", "heap", "mode", "Time [ms]");
+  for (int use_calloc = 0; use_calloc <= 1; use_calloc++) {
+    run_calloc_mode(grow_ops, grow_ops, use_calloc, sizes);
+  }
+  for (int use_calloc = 0; use_calloc <= 1; use_calloc++) {
+    run_calloc_mode(ops, AL_WINDOW, use_calloc, sizes);
+  }
+  free(sizes);
+}
+
+//
+// [Locality benchmark]
+//
+// The challenges only time malloc / free, but where the blocks land decides
+// how fast the program walks its data afterwards. For each allocator, a
+// linked list, a binary search tree and a chained hash table are built on an
+// aged heap (random objects allocated and freed before and in between the
+// nodes, like the rest of a program's data), then walked: the list from head
+// to tail, the tree and the hash table with random lookups. Reported are the
+// build and walk times, the distinct 4 KiB pages the nodes are on and (perf
+// build) the cache and dTLB misses of the walks.
+
+#define LOC_AGING_OBJECTS 20000
+#define LOC_HASH_BUCKETS 4096
+#define LOC_WALKS 10
+
+typedef struct loc_node_t {
+  struct loc_node_t *next;  // The list and the hash chains.
+  struct loc_node_t *left;
+  struct loc_node_t *right;
+  uint64_t key;
+  // Followed by 0-64 bytes of payload, so that the nodes differ in size.
+} loc_node_t;
+
+typedef struct loc_allocator_t {
+  const char *name;
+  void (*initialize_func)();
+  void *(*malloc_func)(size_t size);
+  void (*free_func)(void *ptr);
+  void (*finalize_func)();
+} loc_allocator_t;
+
+// Own generator, so that every allocator sees the same sequence.
+uint64_t loc_rand(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+typedef struct loc_counters_t {
+  int cache_misses_fd;
+  int dtlb_misses_fd;
+  long long cache_misses;
+  long long dtlb_misses;
+  double begin_time;
+  double time;
+} loc_counters_t;
+
+void loc_begin(loc_counters_t *counters) {
+#ifdef ENABLE_PERF_COUNTERS
+  counters->cache_misses_fd =
+      perf_counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  counters->dtlb_misses_fd = perf_counter_open(
+      PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+  counters->cache_misses = perf_counter_read(counters->cache_misses_fd);
+  counters->dtlb_misses = perf_counter_read(counters->dtlb_misses_fd);
+#endif
+  counters->begin_time = get_time();
+}
+
+void loc_end(loc_counters_t *counters) {
+  counters->time = get_time() - counters->begin_time;
+#ifdef ENABLE_PERF_COUNTERS
+  long long cache_misses = perf_counter_read(counters->cache_misses_fd);
+  long long dtlb_misses = perf_counter_read(counters->dtlb_misses_fd);
+  counters->cache_misses = cache_misses < 0 || counters->cache_misses < 0
+                               ? -1
+                               : cache_misses - counters->cache_misses;
+  counters->dtlb_misses = dtlb_misses < 0 || counters->dtlb_misses < 0
+                              ? -1
+                              : dtlb_misses - counters->dtlb_misses;
+  if (counters->cache_misses_fd >= 0) close(counters->cache_misses_fd);
+  if (counters->dtlb_misses_fd >= 0) close(counters->dtlb_misses_fd);
+#else
+  counters->cache_misses = counters->dtlb_misses = -1;
+#endif
+}
+
+int loc_compare_pages(const void *a, const void *b) {
+  uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// The number of distinct 4 KiB pages the |count| nodes are on.
+size_t loc_count_pages(loc_node_t **nodes, size_t count) {
+  uintptr_t *pages = (uintptr_t *)malloc(count * sizeof(uintptr_t));
+  for (size_t i = 0; i < count; i++) {
+    pages[i] = (uintptr_t)nodes[i] / 4096;
+  }
+  qsort(pages, count, sizeof(uintptr_t), loc_compare_pages);
+  size_t distinct = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (i == 0 || pages[i] != pages[i - 1]) distinct++;
+  }
+  free(pages);
+  return distinct;
+}
+
+// Allocate or free one object of the aging pool (8-1024 bytes).
+void loc_churn(const loc_allocator_t *allocator, void **pool,
+               uint64_t *state) {
+  size_t i = loc_rand(state) % LOC_AGING_OBJECTS;
+  if (pool[i]) {
+    allocator->free_func(pool[i]);
+    pool[i] = NULL;
+  } else {
+    pool[i] = allocator->malloc_func((loc_rand(state) % 128 + 1) * 8);
+  }
+}
+
+enum { LOC_LIST, LOC_TREE, LOC_HASH, LOC_STRUCTURES };
+const char *loc_structure_names[] = {"list", "tree", "hash"};
+
+// Returns the sum of key + 1 over the nodes visited / found, so that the
+// walk can't be optimized away and every node counts (key 0 too).
+uint64_t loc_walk(int structure, loc_node_t *root, loc_node_t **buckets,
+                  size_t count, uint64_t *state) {
+  uint64_t sum = 0;
+  if (structure == LOC_LIST) {
+    for (loc_node_t *node = root; node; node = node->next) sum += node->key + 1;
+    return sum;
+  }
+  // As many random lookups as there are nodes. Keys are 0 ... count - 1.
+  for (size_t i = 0; i < count; i++) {
+    uint64_t key = loc_rand(state) % count;
+    loc_node_t *node;
+    if (structure == LOC_TREE) {
+      node = root;
+      while (node && node->key != key) {
+        node = key < node->key ? node->left : node->right;
+      }
+    } else {
+      node = buckets[key % LOC_HASH_BUCKETS];
+      while (node && node->key != key) node = node->next;
+    }
+    sum += node ? node->key + 1 : 0;
+  }
+  return sum;
+}
+
+void run_locality_structure(const loc_allocator_t *allocator, int structure,
+                            size_t count) {
+  uint64_t state = 88172645463325252ULL;
+  void **pool = (void **)calloc(LOC_AGING_OBJECTS, sizeof(void *));
+  loc_node_t **nodes = (loc_node_t **)malloc(count * sizeof(loc_node_t *));
+  loc_node_t **buckets =
+      (loc_node_t **)calloc(LOC_HASH_BUCKETS, sizeof(loc_node_t *));
+  // Keys in random order, so that the tree stays balanced on average.
+  uint64_t *keys = (uint64_t *)malloc(count * sizeof(uint64_t));
+  for (size_t i = 0; i < count; i++) keys[i] = i;
+  for (size_t i = count - 1; i > 0; i--) {
+    size_t j = loc_rand(&state) % (i + 1);
+    uint64_t key = keys[i];
+    keys[i] = keys[j];
+    keys[j] = key;
+  }
+  allocator->initialize_func();
+  for (size_t i = 0; i < 4 * LOC_AGING_OBJECTS; i++) {
+    loc_churn(allocator, pool, &state);
+  }
+
+  loc_counters_t build;
+  loc_begin(&build);
+  loc_node_t *root = NULL, *tail = NULL;
+  for (size_t i = 0; i < count; i++) {
+    loc_churn(allocator, pool, &state);
+    loc_node_t *node = (loc_node_t *)allocator->malloc_func(
+        sizeof(loc_node_t) + loc_rand(&state) % 9 * 8);
+    node->next = node->left = node->right = NULL;
+    node->key = keys[i];
+    nodes[i] = node;
+    if (structure == LOC_LIST) {
+      if (tail) {
+        tail->next = node;
+      } else {
+        root = node;
+      }
+      tail = node;
+    } else if (structure == LOC_TREE) {
+      loc_node_t **link = &root;
+      while (*link) {
+        link = node->key < (*link)->key ? &(*link)->left : &(*link)->right;
+      }
+      *link = node;
+    } else {
+      node->next = buckets[node->key % LOC_HASH_BUCKETS];
+      buckets[node->key % LOC_HASH_BUCKETS] = node;
+    }
+  }
+  loc_end(&build);
+
+  loc_counters_t walk;
+  uint64_t sum = 0;
+  loc_begin(&walk);
+  for (int i = 0; i < LOC_WALKS; i++) {
+    sum += loc_walk(structure, root, buckets, count, &state);
+  }
+  loc_end(&walk);
+  // Every walk visits (or finds) |count| nodes.
+  assert(sum >= LOC_WALKS * count);
+
+  printf("%-9s | %-13s | %10d | %9d | %7zu | %12lld | %11lld\n",
+         loc_structure_names[structure], allocator->name,
+         (int)(build.time * 1000), (int)(walk.time * 1000),
+         loc_count_pages(nodes, count), walk.cache_misses, walk.dtlb_misses);
+  for (size_t i = 0; i < count; i++) allocator->free_func(nodes[i]);
+  for (size_t i = 0; i < LOC_AGING_OBJECTS; i++) {
+    if (pool[i]) allocator->free_func(pool[i]);
+  }
+  allocator->finalize_func();
+  free(keys);
+  free(buckets);
+  free(nodes);
+  free(pool);
+}
+
+void run_locality(size_t count) {
+  const loc_allocator_t allocators[] = {
+      {"simple_malloc", simple_initialize, simple_malloc, simple_free,
+       simple_finalize},
+      {"my_malloc", my_initialize, my_malloc, my_free, my_finalize},
+  };
+  printf("Locality: %zu nodes of 32-96 bytes per structure, %d walks, "
+         "%d aging objects\n",
+         count, LOC_WALKS, LOC_AGING_OBJECTS);
+  printf("%-9s | %-13s | %10s | %9s | %7s | %12s | %11s\n", "structure",
+         "allocator", "build [ms]", "walk [ms]", "pages", "cache misses",
+         "dTLB misses");
+  for (int structure = 0; structure < LOC_STRUCTURES; structure++) {
+    for (size_t a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+      if (my_only && a == 0) continue;
+      run_locality_structure(&allocators[a], structure, count);
+    }
+  }
+}
+
+//
+// [Region benchmark]
+//
+// Request-scoped objects: each request allocates RG_MIN_OBJECTS to
+// RG_MAX_OBJECTS objects of 16-256 bytes (the challenges' size
+// distribution), writes them, checks them and drops them all at the end. One
+// object of each request outlives it in a FIFO of RG_LONG_LIVED objects
+// (always through malloc_func), so the requests don't run on an empty heap.
+// Dropping is one free per object with simple_malloc and my_malloc, and one
+// my_region_destroy() with a region (also with a my_region_free() per object,
+// the no-op, for code that frees each object anyway). Every mode sees the same
+// sizes.
+
+#define RG_MIN_OBJECTS 100
+#define RG_MAX_OBJECTS 1000
+#define RG_LONG_LIVED 1000
+#define RG_SIZES 65536
+
+typedef struct rg_mode_t {
+  const char *name;
+  loc_allocator_t allocator;
+  int use_region;  // 0: free each object, 1: destroy, 2: my_region_free too.
+} rg_mode_t;
+
+void run_region_mode(const rg_mode_t *mode, size_t requests,
+                     const uint32_t *sizes, const uint16_t *counts) {
+  void **objects = (void **)malloc(RG_MAX_OBJECTS * sizeof(void *));
+  void **long_lived = (void **)calloc(RG_LONG_LIVED, sizeof(void *));
+  size_t next_size = 0;
+  mode->allocator.initialize_func();
+  reset_stats();
+  double drop_time = 0;
+  double begin_time = get_time();
+  for (size_t r = 0; r < requests; r++) {
+    my_region_t *region = mode->use_region ? my_region_create() : NULL;
+    size_t count = counts[r];
+    for (size_t i = 0; i < count; i++) {
+      size_t size = sizes[next_size++ % RG_SIZES];
+      char *ptr = region ? (char *)my_region_alloc(region, size)
+                         : (char *)mode->allocator.malloc_func(size);
+      ptr[0] = ptr[size - 1] = (char)i;
+      objects[i] = ptr;
+    }
+    void **slot = &long_lived[r % RG_LONG_LIVED];
+    if (*slot) mode->allocator.free_func(*slot);
+    *slot = mode->allocator.malloc_func(sizes[next_size++ % RG_SIZES]);
+    for (size_t i = 0; i < count; i++) {
+      if (((char *)objects[i])[0] != (char)i) {
+        printf("An allocated object is broken!");
+        assert(0);
+      }
+    }
+    double drop_begin = get_time();
+    if (!region) {
+      for (size_t i = 0; i < count; i++) {
+        mode->allocator.free_func(objects[i]);
+      }
+    } else {
+      if (mode->use_region == 2) {
+        for (size_t i = 0; i < count; i++) {
+          my_region_free(region, objects[i]);
+        }
+      }
+      my_region_destroy(region);
+    }
+    drop_time += get_time() - drop_begin;
+  }
+  double time = get_time() - begin_time;
+  for (size_t i = 0; i < RG_LONG_LIVED; i++) {
+    if (long_lived[i]) mode->allocator.free_func(long_lived[i]);
+  }
+  mode->allocator.finalize_func();
+  printf("%-25s| %10d | %10d | %17zu | %10zu\n", mode->name,
+         (int)(time * 1000), (int)(drop_time * 1000),
+         stats.peak_mapped_size / 1024, stats.mmap_count);
+  free(objects);
+  free(long_lived);
+}
+
+void run_region_benchmark(size_t requests) {
+  if (!my_region_create) {
+    printf("(no my_region_create)\n");
+    return;
+  }
+  uint32_t *sizes = (uint32_t *)malloc(RG_SIZES * sizeof(uint32_t));
+  for (size_t i = 0; i < RG_SIZES; i++) {
+    sizes[i] = get_object_size(16, 256);
+  }
+  uint16_t *counts = (uint16_t *)malloc(requests * sizeof(uint16_t));
+  for (size_t r = 0; r < requests; r++) {
+    counts[r] = RG_MIN_OBJECTS +
+                (uint16_t)(urand() * (RG_MAX_OBJECTS - RG_MIN_OBJECTS + 1));
+  }
+  const rg_mode_t modes[] = {
+      {"simple_malloc, free each",
+       {"simple_malloc", simple_initialize, simple_malloc, simple_free,
+        simple_finalize},
+       0},
+      {"my_malloc, free each",
+       {"my_malloc", my_initialize, my_malloc, my_free, my_finalize},
+       0},
+      {"region, destroy",
+       {"my_malloc", my_initialize, my_malloc, my_free, my_finalize},
+       1},
+      {"region, no-op frees",
+       {"my_malloc", my_initialize, my_malloc, my_free, my_finalize},
+       2},
+  };
+  printf("Regions: %zu requests of %d-%d objects (16-256 bytes), %d "
+         "long-lived\n",
+         requests, RG_MIN_OBJECTS, RG_MAX_OBJECTS, RG_LONG_LIVED);
+  printf("%-25s| %10s | %10s | %17s | %10s\n", "mode", "Time [ms]",
+         "drop [ms]", "peak mapped [KiB]", "mmap calls");
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+    if (my_only && m == 0) continue;
+    run_region_mode(&modes[m], requests, sizes, counts);
+  }
+  free(sizes);
+  free(counts);
+}
+
+void usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [--replay] [--workload-out=PREFIX] "
+          "[--workload-in=PREFIX] [--epoch-stats=PREFIX]\n"
+          "       [--my-only] [--challenge=N] [--producer-consumer[=N]] "
+          "[--aligned[=N]]\n"
+          "       [--locality[=N]] [--burst-latency] [--region[=N]]\n"
+          "  --replay                generate each challenge's op stream "
+          "before timing,\n"
+          "                          then replay it for both allocators\n"
+          "  --workload-out=PREFIX   (implies --replay) also write it to "
+          "PREFIX<challenge>.wl\n"
+          "  --workload-in=PREFIX    (implies --replay) replay "
+          "PREFIX<challenge>.wl instead\n"
+          "  --epoch-stats=PREFIX    write live/mapped bytes and syscall "
+          "counts at every\n"
+          "                          epoch to "
+          "PREFIX<challenge>_<simple|my>.csv\n"
+          "  --my-only               don't run simple_malloc\n"
+          "  --challenge=N           only run challenge N\n"
+          "  --producer-consumer[=N] instead of the challenges, pass N "
+          "objects from an\n"
+          "                          allocating thread to a freeing one "
+          "(lock vs. remote)\n"
+          "  --aligned[=N]           instead of the challenges, benchmark "
+          "my_aligned_alloc\n"
+          "                          (64 and 4096) and my_calloc on N "
+          "objects\n"
+          "  --locality[=N]          instead of the challenges, build a "
+          "list, a tree and a\n"
+          "                          hash table of N nodes with each "
+          "allocator and time walking them\n"
+          "  --burst-latency         (implies --replay) time each malloc of "
+          "the peak epochs,\n"
+          "                          also with my_reserve() before them\n"
+          "  --region[=N]            instead of the challenges, N requests "
+          "that drop all their\n"
+          "                          objects at once: free each vs. "
+          "my_region_destroy\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
 int main(int argc, char **argv) {
+  size_t producer_consumer_ops = 0;
+  size_t aligned_ops = 0;
+  size_t locality_nodes = 0;
+  size_t region_requests = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--replay") == 0) {
+      replay_mode = 1;
+    } else if (strncmp(argv[i], "--workload-out=", 15) == 0) {
+      replay_mode = 1;
+      workload_out_prefix = argv[i] + 15;
+    } else if (strncmp(argv[i], "--workload-in=", 14) == 0) {
+      replay_mode = 1;
+      workload_in_prefix = argv[i] + 14;
+    } else if (strncmp(argv[i], "--epoch-stats=", 14) == 0) {
+      epoch_stats_prefix = argv[i] + 14;
+    } else if (strcmp(argv[i], "--producer-consumer") == 0) {
+      producer_consumer_ops = 4000000;
+    } else if (strncmp(argv[i], "--producer-consumer=", 20) == 0) {
+      producer_consumer_ops = strtoull(argv[i] + 20, NULL, 10);
+      if (!producer_consumer_ops) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--aligned") == 0) {
+      aligned_ops = 500000;
+    } else if (strncmp(argv[i], "--aligned=", 10) == 0) {
+      aligned_ops = strtoull(argv[i] + 10, NULL, 10);
+      if (!aligned_ops) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--locality") == 0) {
+      locality_nodes = 50000;
+    } else if (strncmp(argv[i], "--locality=", 11) == 0) {
+      locality_nodes = strtoull(argv[i] + 11, NULL, 10);
+      if (!locality_nodes) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--region") == 0) {
+      region_requests = 1000;
+    } else if (strncmp(argv[i], "--region=", 9) == 0) {
+      region_requests = strtoull(argv[i] + 9, NULL, 10);
+      if (!region_requests) {
+        usage(argv[0]);
+      }
+    } else if (strcmp(argv[i], "--burst-latency") == 0) {
+      replay_mode = 1;
+      burst_latency_mode = 1;
+    } else if (strcmp(argv[i], "--my-only") == 0) {
+      my_only = 1;
+    } else if (strncmp(argv[i], "--challenge=", 12) == 0) {
+      only_challenge = atoi(argv[i] + 12);
+      if (only_challenge < FIRST_CHALLENGE_INDEX ||
+          only_challenge > LAST_CHALLENGE_INDEX) {
+        usage(argv[0]);
+      }
+    } else {
+      usage(argv[0]);
+    }
+  }
   srand(12);  // Set the rand seed to make the challenges non-deterministic.
   printf("Welcome to the malloc challenge!\n");
   printf("size_of(uint8_t *) = %ld\n", sizeof(uint8_t *));
@@ -411,6 +1931,22 @@ int main(int argc, char **argv) {
   printf("Running tests...\n");
   test();
   printf("Finished!\n\n");
+  if (producer_consumer_ops) {
+    run_producer_consumer(producer_consumer_ops);
+    return 0;
+  }
+  if (aligned_ops) {
+    run_aligned_benchmark(aligned_ops);
+    return 0;
+  }
+  if (locality_nodes) {
+    run_locality(locality_nodes);
+    return 0;
+  }
+  if (region_requests) {
+    run_region_benchmark(region_requests);
+    return 0;
+  }
   run_challenges();
   return 0;
 }
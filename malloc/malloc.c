@@ -1,5 +1,6 @@
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -12,10 +13,77 @@
 
 void *mmap_from_system(size_t size);
 void munmap_to_system(void *ptr, size_t size);
+int advise_hugepage_to_system(void *ptr, size_t size);
+void purge_to_system(void *ptr, size_t size);
+void unpurge_from_system(void *ptr, size_t size);
+
+// tuning knobs are #ifndef so that a build can override them with -D (see autotune.cc)
 
 //10 bins for 2's power of size
 #define BIN_NUMBER 10
+// page size, a power of two multiple of 4096
+#ifndef BUFFER_SIZE
 #define BUFFER_SIZE 4096
+#endif
+// quick lists: one LIFO stack per exact size 8, 16, ... QUICK_MAX_SIZE
+#ifndef QUICK_MAX_SIZE
+#define QUICK_MAX_SIZE 256
+#endif
+#define QUICK_LIST_NUMBER (QUICK_MAX_SIZE / 8)
+// consolidate the quick lists once they hold this many bytes
+#define QUICK_CONSOLIDATE_BYTES (16 * BUFFER_SIZE)
+#ifdef MY_MALLOC_HUGE_ARENA
+// arena mode: pages are carved from 2 MiB aligned arenas that ask for transparent huge pages
+#define ARENA_SIZE (2 * 1024 * 1024)
+#endif
+// emptied pages are retained for reuse: the first few stay resident,
+// the rest are purged, and (outside arena mode) past that they are unmapped
+#ifndef MAX_DIRTY_PAGES
+#define MAX_DIRTY_PAGES 4
+#endif
+#ifndef MAX_PURGED_PAGES
+#define MAX_PURGED_PAGES 256
+#endif
+// pages of destroyed regions kept resident for the next regions (and my_malloc), see my_region_destroy
+#ifndef MAX_REGION_CACHE_PAGES
+#define MAX_REGION_CACHE_PAGES 64
+#endif
+// pages with fewer live bytes than this are left to drain: their free slots go to the back of the bins
+// and their frees skip the quick lists
+#ifndef SPARSE_PAGE_BYTES
+#define SPARSE_PAGE_BYTES (BUFFER_SIZE / 4)
+#endif
+// free slots of bin TREE_BIN and above (> 1024 bytes by default) live in a size-ordered tree instead of bin lists
+#ifndef TREE_BIN
+#define TREE_BIN 8
+#endif
+// number of distinct slot sizes below the tree (8, 16, ... 1024 by default), bin i ends at 8 << i
+#define SMALL_SLOT_SIZES (1 << (TREE_BIN - 1))
+#ifdef MY_MALLOC_SITE_ARENAS
+// site-affinity build (preload.c): the caller keeps MY_MALLOC_SITE_ARENAS heaps of my_heap_create() and
+// allocates from the one of the call site, so that a site's objects share pages
+#if MY_MALLOC_SITE_ARENAS < 1
+#error "MY_MALLOC_SITE_ARENAS must be at least 1"
+#endif
+#endif
+// a split leaves a free slot behind only if it gets at least this much payload,
+// otherwise the tail stays with the object
+#ifndef SPLIT_MIN_SIZE
+#define SPLIT_MIN_SIZE 8
+#endif
+
+#if BUFFER_SIZE < 4096 || (BUFFER_SIZE & (BUFFER_SIZE - 1))
+#error "BUFFER_SIZE must be a power of two >= 4096"
+#endif
+#if QUICK_MAX_SIZE < 8 || QUICK_MAX_SIZE % 8
+#error "QUICK_MAX_SIZE must be a positive multiple of 8"
+#endif
+#if TREE_BIN < 1 || TREE_BIN >= BIN_NUMBER
+#error "TREE_BIN must be in [1, BIN_NUMBER)"
+#endif
+#if SPLIT_MIN_SIZE < 8 || SPLIT_MIN_SIZE % 8
+#error "SPLIT_MIN_SIZE must be a positive multiple of 8"
+#endif
 
 // Struct definitions
 
@@ -34,8 +102,128 @@ typedef struct page_info_t{
   void *start_addr;
   struct page_info_t *next;
   struct page_info_t *prev;
+  // blocks on the page that aren't in the bins/tree (in use or quick-listed),
+  // everything else has been merged into one slot once this drops to 0
+  uint32_t used_blocks;
+  // payload bytes of the in-use blocks, how full the page is for placement
+  uint32_t live_bytes;
+#ifdef MY_MALLOC_SITE_ARENAS
+  // the heap the page belongs to, so that my_free() finds it
+  struct heap_t *heap;
+#endif
 }page_info_t;
 
+// a free slot indexed by the large-slot tree, the node fields live in the slot's free space.
+// red-black tree ordered by (size, address), so the leftmost fit is the best fit at the lowest address
+typedef struct tree_node_t {
+  // |next| and |prev| both point at the heap's tree_marker, so neighbors still see a free slot
+  metadata_t metadata;
+  struct tree_node_t *left;
+  struct tree_node_t *right;
+  struct tree_node_t *parent;
+  bool red;
+} tree_node_t;
+
+// the smallest slot in the tree (bin TREE_BIN starts above 8 << (TREE_BIN - 1)) must hold the node,
+// so TREE_BIN >= 3
+_Static_assert((8 << (TREE_BIN - 1)) + sizeof(metadata_t) >= sizeof(tree_node_t),
+               "TREE_BIN too small: its slots can't hold a tree_node_t");
+
+#ifdef MY_MALLOC_TELEMETRY
+// telemetry build (-DMY_MALLOC_TELEMETRY): hot path counters, dumped by my_finalize
+#define SEARCH_HISTOGRAM_BUCKETS 12
+typedef struct telemetry_t {
+  size_t quick_hits;// my_malloc served from a quick list
+  size_t quick_misses;// quick-list sized my_malloc that found its list empty
+  size_t quick_frees;// my_free parked in a quick list
+  size_t coalesced_frees;// my_free that merged right away
+  size_t consolidations;
+  size_t bin_hits;// find_best_fit found a slot
+  size_t bin_misses;
+  size_t list_nodes_visited;
+  size_t tree_nodes_visited;
+  // searches by nodes visited (lists + tree): bucket i counts [2^(i-1), 2^i), bucket 0 counts 0
+  size_t search_length_histogram[SEARCH_HISTOGRAM_BUCKETS];
+  size_t splits;
+  size_t left_merges;
+  size_t right_merges;
+  size_t wilderness_bumps;
+  size_t wilderness_returns;// free slots given back to the wilderness
+  size_t wilderness_retires;
+  size_t find_page_calls;
+  size_t pages_mapped;// new pages from the system (or from an arena)
+  size_t pages_reused;// retained pages handed out again
+  size_t pages_retained;// emptied pages kept resident
+  size_t pages_purged;
+  size_t pages_unmapped;
+  size_t arenas_mapped;
+  size_t direct_maps;// blocks given a mapping of their own
+  size_t calloc_zeroed_bytes;// my_calloc bytes that needed a memset
+  size_t calloc_skipped_bytes;// and the ones known to be zero already
+} telemetry_t;
+// (in a function that has the |heap| it's working on)
+#define TELEMETRY_INC(counter) (heap->telemetry.counter++)
+#define TELEMETRY_ADD(counter, n) (heap->telemetry.counter += (n))
+#else
+#define TELEMETRY_INC(counter)
+#define TELEMETRY_ADD(counter, n)
+#endif
+
+// a chunk of a region: a page from map_page(), or a mapping of its own for what doesn't fit in a page
+typedef struct region_chunk_t {
+  struct region_chunk_t *next;// the chunk before this one
+  size_t size;// BUFFER_SIZE for pages
+} region_chunk_t;
+
+// objects that die together (my_region_create): bumped out of a chain of pages and all given
+// back at once by my_region_destroy(). lives right after the chunk header of its first page
+typedef struct my_region_t {
+  region_chunk_t *chunks;// pages, the newest first (so the one holding the region is the last)
+  size_t pages;
+  region_chunk_t *big_chunks;// mappings of their own
+  char *ptr;// bump pointer of the newest page
+  char *end;
+  size_t allocated_bytes;
+} my_region_t;
+
+// what my_heap_stats() returns, every field is kept up to date as the heap changes
+typedef struct my_heap_stats_t {
+  size_t mapped_bytes;// mapped from the system and not unmapped/purged (pages, retained pages, unused arena)
+  size_t live_bytes;// allocated objects (block sizes, no metadata/footer)
+  size_t direct_bytes;// the part of live_bytes in mappings of their own (not in any page)
+  size_t free_bytes;// bins + quick lists + wilderness
+  size_t bin_free_bytes[BIN_NUMBER];// free slots by bin (tree slots count in bins 8 and 9)
+  size_t quick_bytes;// parked in quick lists
+  size_t wilderness_bytes;// usable size of the wilderness
+  size_t retained_bytes;// emptied pages (and pages of destroyed regions) kept resident for reuse
+  size_t reserved_bytes;// prefaulted by my_reserve() and not used yet
+  size_t region_bytes;// pages & chunks held by regions that aren't destroyed yet (not in live_bytes)
+  size_t largest_free_block;
+  size_t page_count;// pages holding blocks
+  size_t remote_drains;// drain_remote_frees calls that found something
+  size_t remote_drained;// blocks freed by them
+  double fragmentation;// 1 - largest_free_block / free_bytes, 0 when nothing is free
+} my_heap_stats_t;
+
+// one block reported by my_heap_walk()
+typedef enum my_heap_block_state_t {
+  HEAP_BLOCK_IN_USE,
+  HEAP_BLOCK_FREE,// in a bin or the tree
+  HEAP_BLOCK_QUICK,// parked in a quick list
+  HEAP_BLOCK_WILDERNESS,// the not yet bumped tail of the wilderness page
+} my_heap_block_state_t;
+
+typedef struct my_heap_block_t {
+  void *page;// start of the page (its page_info_t)
+  void *block;// the block's metadata, or the start of the wilderness
+  size_t size;// payload size (wilderness: its whole length)
+  size_t footer_size;// what the footer says, equals |size| in a healthy heap (wilderness: 0)
+  my_heap_block_state_t state;
+} my_heap_block_t;
+
+// return false to stop the walk
+typedef bool (*my_heap_walk_func_t)(const my_heap_block_t *block, void *arg);
+
 typedef struct bin_t {
   metadata_t dummy_head;
   metadata_t dummy_tail; 
@@ -46,9 +234,67 @@ typedef struct heap_t {
   bin_t bins[BIN_NUMBER];
   // the start of pages
   page_info_t *page_head;
+  // wilderness: the untouched tail [wild_ptr, wild_end) of the newest page,
+  // new objects are carved from it by bumping wild_ptr
+  char *wild_ptr;
+  char *wild_end;
+  // [wild_zero, wild_end) has never been written since the page was mapped, so it's still zero
+  // (wild_end if the page came back from the retained pages)
+  char *wild_zero;
+  // freed small blocks that skipped coalescing, indexed by size / 8 - 1,
+  // linked through the first word of the payload (see quick_link), |next| stays NULL
+  // so neighbors see them as in use and |prev| points at quick_marker for the heap walker
+  metadata_t *quick_lists[QUICK_LIST_NUMBER];
+  size_t quick_bytes;
+  metadata_t quick_marker;
+  // large free slots (bin >= TREE_BIN), tree_max is the rightmost node
+  tree_node_t *tree_root;
+  tree_node_t *tree_max;
+  metadata_t tree_marker;
+  // blocks with a mapping of their own (see map_direct) have |prev| pointing here
+  metadata_t direct_marker;
+  // the metadata of page-aligned direct blocks (see map_aligned_direct), open addressing on the payload
+  // address in a mapping of its own, an empty slot has |next| == NULL
+  metadata_t *aligned_directs;
+  size_t aligned_direct_slots;// a power of two, 0 until the first one
+  size_t aligned_direct_count;
+  // kept up to date for my_heap_stats()
+  size_t live_bytes;
+  size_t direct_bytes;
+  size_t mapped_bytes;
+  size_t region_bytes;
+  size_t page_count;
+  size_t bin_free_bytes[BIN_NUMBER];
+  size_t small_free_slots[SMALL_SLOT_SIZES];// number of binned slots of each size below the tree
+  // arena mode only: the not yet used part of the current arena
+  char *arena_ptr;
+  char *arena_end;
+  // emptied pages waiting to be reused. dirty ones are still resident (linked through page_info_t::next),
+  // purged ones were given back with purge_to_system, so they're kept here and never touched until reused
+  page_info_t *dirty_page_head;
+  size_t dirty_pages;
+  // (one slot when MAX_PURGED_PAGES is 0, never used: purged_pages stays 0)
+  void *purged_page_stack[MAX_PURGED_PAGES ? MAX_PURGED_PAGES : 1];
+  size_t purged_pages;
+  // pages of destroyed regions, still resident and chained through region_chunk_t::next
+  region_chunk_t *region_cache;
+  size_t region_cache_pages;
+  // pages mapped and prefaulted ahead of time by my_reserve(), handed out before anything else is mapped
+  page_info_t *reserve_page_head;
+  size_t reserve_pages;
+#ifdef MY_MALLOC_TELEMETRY
+  telemetry_t telemetry;
+  size_t telemetry_runs;// my_finalize calls so far, not reset by my_initialize
+#endif
+  size_t remote_drains;
+  size_t remote_drained;
+  // blocks freed by other threads with my_free_remote (linked through the payload like the quick lists),
+  // the only field that isn't owner-only, so it gets a cache line of its own
+  _Alignas(64) _Atomic(metadata_t *) remote_frees;
 } heap_t;
 
 // Static variables (DO NOT ADD ANOTHER STATIC VARIABLES!)
+// the helpers work on the heap they're given, the my_* interfaces pass this one
 heap_t my_heap;
 
 
@@ -76,26 +322,253 @@ void set_footer(metadata_t *metadata){
   footer->size = metadata->size;
 }
 
-// given an address, traverse all page DLL and find which page it belongs to
-page_info_t *find_page(void *addr){
-  page_info_t *page = my_heap.page_head;
-  while (page){
-    if(addr >= page->start_addr && addr < (void *)((char *)page->start_addr + BUFFER_SIZE)){
-      //if addr is in the middle of page region(start, start + 4096)
-      return page;
+// large-slot tree (red-black, NULL leaves), see tree_node_t
+
+bool tree_less(tree_node_t *a, tree_node_t *b){
+  return a->metadata.size < b->metadata.size || (a->metadata.size == b->metadata.size && a < b);
+}
+
+void tree_rotate_left(heap_t *heap, tree_node_t *x){
+  tree_node_t *y = x->right;
+  x->right = y->left;
+  if (y->left){y->left->parent = x;}
+  y->parent = x->parent;
+  if (!x->parent){
+    heap->tree_root = y;
+  }else if (x == x->parent->left){
+    x->parent->left = y;
+  }else{
+    x->parent->right = y;
+  }
+  y->left = x;
+  x->parent = y;
+}
+
+void tree_rotate_right(heap_t *heap, tree_node_t *x){
+  tree_node_t *y = x->left;
+  x->left = y->right;
+  if (y->right){y->right->parent = x;}
+  y->parent = x->parent;
+  if (!x->parent){
+    heap->tree_root = y;
+  }else if (x == x->parent->right){
+    x->parent->right = y;
+  }else{
+    x->parent->left = y;
+  }
+  y->right = x;
+  x->parent = y;
+}
+
+void tree_insert(heap_t *heap, tree_node_t *node){
+  if (!heap->tree_max || tree_less(heap->tree_max, node)){
+    heap->tree_max = node;
+  }
+  node->metadata.next = &heap->tree_marker;
+  node->metadata.prev = &heap->tree_marker;
+  node->left = NULL;
+  node->right = NULL;
+  node->red = true;
+  tree_node_t *parent = NULL;
+  tree_node_t *cur = heap->tree_root;
+  while (cur){
+    parent = cur;
+    cur = tree_less(node, cur) ? cur->left : cur->right;
+  }
+  node->parent = parent;
+  if (!parent){
+    heap->tree_root = node;
+  }else if (tree_less(node, parent)){
+    parent->left = node;
+  }else{
+    parent->right = node;
+  }
+  // fix up red-red violations on the way up
+  while (node->parent && node->parent->red){
+    tree_node_t *grand = node->parent->parent;// exists, a red node is never the root
+    if (node->parent == grand->left){
+      tree_node_t *uncle = grand->right;
+      if (uncle && uncle->red){
+        node->parent->red = false;
+        uncle->red = false;
+        grand->red = true;
+        node = grand;
+      }else{
+        if (node == node->parent->right){
+          node = node->parent;
+          tree_rotate_left(heap, node);
+        }
+        node->parent->red = false;
+        grand->red = true;
+        tree_rotate_right(heap, grand);
+      }
+    }else{
+      tree_node_t *uncle = grand->left;
+      if (uncle && uncle->red){
+        node->parent->red = false;
+        uncle->red = false;
+        grand->red = true;
+        node = grand;
+      }else{
+        if (node == node->parent->left){
+          node = node->parent;
+          tree_rotate_right(heap, node);
+        }
+        node->parent->red = false;
+        grand->red = true;
+        tree_rotate_left(heap, grand);
+      }
     }
-    page = page->next;
   }
-  return NULL;//pointer out of mmaped area
+  heap->tree_root->red = false;
+}
+
+// put |to| (may be NULL) where |from| hangs
+void tree_transplant(heap_t *heap, tree_node_t *from, tree_node_t *to){
+  if (!from->parent){
+    heap->tree_root = to;
+  }else if (from == from->parent->left){
+    from->parent->left = to;
+  }else{
+    from->parent->right = to;
+  }
+  if (to){to->parent = from->parent;}
+}
+
+bool tree_is_red(tree_node_t *node){
+  return node && node->red;
+}
+
+void tree_remove(heap_t *heap, tree_node_t *node){
+  if (node == heap->tree_max){
+    // the new max is node's predecessor
+    tree_node_t *max = node->left;
+    if (max){
+      while (max->right){max = max->right;}
+    }else{
+      // the max has no right child, so its predecessor is its parent (or nothing)
+      max = node->parent;
+    }
+    heap->tree_max = max;
+  }
+  tree_node_t *child;// takes the removed position, may be NULL so keep its parent around
+  tree_node_t *child_parent;
+  bool removed_red = node->red;
+  if (!node->left){
+    child = node->right;
+    child_parent = node->parent;
+    tree_transplant(heap, node, node->right);
+  }else if (!node->right){
+    child = node->left;
+    child_parent = node->parent;
+    tree_transplant(heap, node, node->left);
+  }else{
+    // two children: the successor takes node's place
+    tree_node_t *successor = node->right;
+    while (successor->left){successor = successor->left;}
+    removed_red = successor->red;
+    child = successor->right;
+    if (successor->parent == node){
+      child_parent = successor;
+    }else{
+      child_parent = successor->parent;
+      tree_transplant(heap, successor, successor->right);
+      successor->right = node->right;
+      successor->right->parent = successor;
+    }
+    tree_transplant(heap, node, successor);
+    successor->left = node->left;
+    successor->left->parent = successor;
+    successor->red = node->red;
+  }
+  if (removed_red){return;}
+  // a black node went away, push the missing black up from |child|
+  while (child != heap->tree_root && !tree_is_red(child)){
+    if (child == child_parent->left){
+      tree_node_t *sibling = child_parent->right;
+      if (sibling->red){
+        sibling->red = false;
+        child_parent->red = true;
+        tree_rotate_left(heap, child_parent);
+        sibling = child_parent->right;
+      }
+      if (!tree_is_red(sibling->left) && !tree_is_red(sibling->right)){
+        sibling->red = true;
+        child = child_parent;
+        child_parent = child->parent;
+      }else{
+        if (!tree_is_red(sibling->right)){
+          sibling->left->red = false;
+          sibling->red = true;
+          tree_rotate_right(heap, sibling);
+          sibling = child_parent->right;
+        }
+        sibling->red = child_parent->red;
+        child_parent->red = false;
+        sibling->right->red = false;
+        tree_rotate_left(heap, child_parent);
+        child = heap->tree_root;
+      }
+    }else{
+      tree_node_t *sibling = child_parent->left;
+      if (sibling->red){
+        sibling->red = false;
+        child_parent->red = true;
+        tree_rotate_right(heap, child_parent);
+        sibling = child_parent->left;
+      }
+      if (!tree_is_red(sibling->left) && !tree_is_red(sibling->right)){
+        sibling->red = true;
+        child = child_parent;
+        child_parent = child->parent;
+      }else{
+        if (!tree_is_red(sibling->left)){
+          sibling->right->red = false;
+          sibling->red = true;
+          tree_rotate_left(heap, sibling);
+          sibling = child_parent->left;
+        }
+        sibling->red = child_parent->red;
+        child_parent->red = false;
+        sibling->left->red = false;
+        tree_rotate_right(heap, child_parent);
+        child = heap->tree_root;
+      }
+    }
+  }
+  if (child){child->red = false;}
+}
+
+// smallest slot with size >= |size|, lowest address among equal sizes
+tree_node_t *tree_best_fit(heap_t *heap, size_t size){
+  tree_node_t *best = NULL;
+  tree_node_t *cur = heap->tree_root;
+  while (cur){
+    TELEMETRY_INC(tree_nodes_visited);
+    if (cur->metadata.size >= size){
+      best = cur;
+      cur = cur->left;
+    }else{
+      cur = cur->right;
+    }
+  }
+  return best;
+}
+
+// given an address inside a page, find its page_info_t:
+// pages are BUFFER_SIZE aligned (see map_page), so it's just the address rounded down
+page_info_t *find_page(heap_t *heap, void *addr){
+  TELEMETRY_INC(find_page_calls);
+  return (page_info_t *)((uintptr_t)addr & ~(uintptr_t)(BUFFER_SIZE - 1));
 }
 
 
 // get current metadata's left neighbor from footer
 // return it's left neighbor if it's free, else NULL
 // what type should i return?
-metadata_t *get_left_neighbor(metadata_t *metadata){
+metadata_t *get_left_neighbor(heap_t *heap, metadata_t *metadata){
   //check page and metadatas' range
-  page_info_t *page = find_page(metadata);
+  page_info_t *page = find_page(heap, metadata);
   if(!page){return NULL;}//out of mmaped range
 
   // if it's the first metadata in page, there's no left
@@ -115,14 +588,16 @@ metadata_t *get_left_neighbor(metadata_t *metadata){
   return NULL;
 }
 
-metadata_t *get_right_neighbor(metadata_t *metadata){
+metadata_t *get_right_neighbor(heap_t *heap, metadata_t *metadata){
   // move pointer (current)metadata|size|footer|(go_to_here)right_metadata|
-  page_info_t *page = find_page(metadata);
+  page_info_t *page = find_page(heap, metadata);
   if(!page){return NULL;}//out of mmaped range
   void *page_end = (char *)page->start_addr + BUFFER_SIZE;
   void *footer_end = (char *)metadata + sizeof(metadata_t) + metadata->size + sizeof(footer_t);
   // if it's the last metadata in page, there's no right
   if (footer_end >= page_end ){return NULL;}
+  // the bytes after the last bumped object are wilderness, not a metadata
+  if (footer_end == (void *)heap->wild_ptr){return NULL;}
 
   // find right metadata
   metadata_t *right_neighbor = (metadata_t *)((char *)metadata + sizeof(metadata_t) + metadata->size + sizeof(footer_t));
@@ -150,7 +625,16 @@ metadata_t *merge_right(metadata_t *metadata, metadata_t *right){
 }
 
 
-void my_remove_from_free_list(metadata_t *metadata) {
+void my_remove_from_free_list(heap_t *heap, metadata_t *metadata) {
+  int bin_idx = get_bin_index(metadata->size);
+  heap->bin_free_bytes[bin_idx] -= metadata->size;
+  if (metadata->next == &heap->tree_marker){
+    tree_remove(heap, (tree_node_t *)metadata);
+    metadata->next = NULL;
+    metadata->prev = NULL;
+    return;
+  }
+  heap->small_free_slots[metadata->size / 8 - 1]--;
   // reconnect DLL
   metadata->prev->next = metadata->next;
   metadata->next->prev = metadata->prev;
@@ -160,66 +644,81 @@ void my_remove_from_free_list(metadata_t *metadata) {
 }
 
 
-metadata_t *check_and_merge(metadata_t *metadata){
+metadata_t *check_and_merge(heap_t *heap, metadata_t *metadata){
   // no need to remove new income metadata from free list because we do this before adding
   //the wrapper function to perform left/right/both side merge before adding to free list
-  metadata_t *left = get_left_neighbor(metadata);
-  metadata_t *right = get_right_neighbor(metadata);
+  metadata_t *left = get_left_neighbor(heap, metadata);
+  metadata_t *right = get_right_neighbor(heap, metadata);
   if (left){
-    my_remove_from_free_list(left);//remove origin left
+    my_remove_from_free_list(heap, left);//remove origin left
     metadata = merge_left(metadata, left);//current metadata is pointing to original left
+    TELEMETRY_INC(left_merges);
   }
   if (right){
-    my_remove_from_free_list(right);//remove origin right
+    my_remove_from_free_list(heap, right);//remove origin right
     metadata = merge_right(metadata, right);
+    TELEMETRY_INC(right_merges);
   }
   return metadata;
 }
 
 
-bool is_empty_page(page_info_t *page){
-  // find first metadata
-  void *first_metafata_addr = (char *)page->start_addr + sizeof(page_info_t);
-  metadata_t *metadata = (metadata_t *)first_metafata_addr;
-
-  void *page_end = (char *)page->start_addr + BUFFER_SIZE;
-  size_t empty_size = BUFFER_SIZE - sizeof(page_info_t) - sizeof(metadata_t) - sizeof(footer_t);
-  // check metadata size matches and it's free
-  if (metadata->size == empty_size && metadata->next!=NULL && metadata->prev!=NULL){
-    // double check footer
-    // footer_t *footer = (footer_t *)((char *)metadata + sizeof(metadata) + metadata->size);
-    // if((char *)footer + sizeof(footer_t) == (char *)page_end){
-    //   return true;
-    // }
-    return true;
+bool is_empty_page(heap_t *heap, page_info_t *page){
+  // the wilderness page is kept for bumping even when nothing lives on it
+  // (its first metadata may be stale after the wilderness shrank back)
+  if ((char *)page->start_addr + BUFFER_SIZE == heap->wild_end){
+    return false;
   }
-  return false;
+  // nothing in use or parked, so the merges left a single free slot from the first metadata to the page end
+  return page->used_blocks == 0;
 }
 
-void remove_page_from_list(page_info_t *page){
+void remove_page_from_list(heap_t *heap, page_info_t *page){
   if (page->prev){
     //if current page is not head, reconnect prev to next
     page->prev->next = page->next;
   }else{
     //if current page is head, change head
-    my_heap.page_head = page->next;
+    heap->page_head = page->next;
   }
   if (page->next){
     //if current page is not tail, reconnect next to prev
     page->next->prev = page->prev;
   }
+  heap->page_count--;
 }
 
-void my_add_to_free_list(metadata_t *metadata) {
+void my_add_to_free_list(heap_t *heap, metadata_t *metadata) {
   assert(!metadata->next && !metadata->prev);
   // check if anything to merge, update metadata points to the merged address
-  metadata_t *merged_metadata = check_and_merge(metadata);
+  metadata_t *merged_metadata = check_and_merge(heap, metadata);
+  if ((char *)merged_metadata + sizeof(metadata_t) + merged_metadata->size + sizeof(footer_t) == heap->wild_ptr){
+    // the free slot touches the wilderness, give it back instead of binning it
+    heap->wild_ptr = (char *)merged_metadata;
+    TELEMETRY_INC(wilderness_returns);
+    return;
+  }
   set_footer(merged_metadata);//add a new footer at the end of merged free memory
 
   //put into corresponding bin:
   int bin_idx = get_bin_index(merged_metadata->size);
-  bin_t *bin = &my_heap.bins[bin_idx];
+  heap->bin_free_bytes[bin_idx] += merged_metadata->size;
+  if (bin_idx >= TREE_BIN){
+    // large slots are indexed by the tree instead
+    tree_insert(heap, (tree_node_t *)merged_metadata);
+    return;
+  }
+  heap->small_free_slots[merged_metadata->size / 8 - 1]++;
+  bin_t *bin = &heap->bins[bin_idx];
 
+  if (find_page(heap, merged_metadata)->live_bytes < SPARSE_PAGE_BYTES){
+    // slots of nearly empty pages go last, so find_best_fit takes them only when nothing else fits
+    merged_metadata->next = &bin->dummy_tail;
+    merged_metadata->prev = bin->dummy_tail.prev;
+    bin->dummy_tail.prev->next = merged_metadata;
+    bin->dummy_tail.prev = merged_metadata;
+    return;
+  }
   // reconnect DLL
   merged_metadata->next = bin->dummy_head.next; //the next is merged_metadata pointer
   merged_metadata->prev = &bin->dummy_head; // the dummy_head is an actuall value, so need &
@@ -228,48 +727,403 @@ void my_add_to_free_list(metadata_t *metadata) {
 }
 
 //pages helper, add a new page to pages' head by it's start address
-void add_to_page_list(page_info_t *page_start){
+void add_to_page_list(heap_t *heap, page_info_t *page_start){
   //claim the page start address to contain page_info
   page_info_t *page_info = (page_info_t *)page_start;
   page_info->start_addr = page_start;
   //add new page to head of connect pages DLL, 
-  page_info->next = my_heap.page_head;
+  page_info->next = heap->page_head;
   page_info->prev = NULL;
-  if(my_heap.page_head!=NULL){
-    my_heap.page_head->prev=page_info;
+  page_info->used_blocks = 0;
+  page_info->live_bytes = 0;
+#ifdef MY_MALLOC_SITE_ARENAS
+  page_info->heap = heap;
+#endif
+  if(heap->page_head!=NULL){
+    heap->page_head->prev=page_info;
   }
-  my_heap.page_head = page_info;
+  heap->page_head = page_info;
+  heap->page_count++;
 }
 
-// Interfaces of malloc (DO NOT RENAME FOLLOWING FUNCTIONS!)
+// a new BUFFER_SIZE aligned page from the system (or the current arena), all zero
+void *map_new_page(heap_t *heap){
+#ifdef MY_MALLOC_HUGE_ARENA
+  if (heap->arena_ptr == heap->arena_end){
+    // over-reserve so that an ARENA_SIZE aligned arena fits, then trim both ends
+    char *region = mmap_from_system(2 * ARENA_SIZE);
+    if (!region){
+      return NULL;
+    }
+    char *arena = (char *)(((uintptr_t)region + ARENA_SIZE - 1) & ~(uintptr_t)(ARENA_SIZE - 1));
+    if (arena > region){
+      munmap_to_system(region, arena - region);
+    }
+    if (region + 2 * ARENA_SIZE > arena + ARENA_SIZE){
+      munmap_to_system(arena + ARENA_SIZE, region + ARENA_SIZE - arena);
+    }
+    // if THP is off the kernel says no, and the arena simply stays on 4 KiB pages
+    advise_hugepage_to_system(arena, ARENA_SIZE);
+    heap->mapped_bytes += ARENA_SIZE;
+    TELEMETRY_INC(arenas_mapped);
+    heap->arena_ptr = arena;
+    heap->arena_end = arena + ARENA_SIZE;
+  }
+  void *page_start = heap->arena_ptr;
+  heap->arena_ptr += BUFFER_SIZE;
+  TELEMETRY_INC(pages_mapped);
+  return page_start;
+#else
+  TELEMETRY_INC(pages_mapped);
+  heap->mapped_bytes += BUFFER_SIZE;
+  if (BUFFER_SIZE == 4096){
+    return mmap_from_system(BUFFER_SIZE);
+  }
+  // bigger pages only come 4096 aligned, trim them like the arenas
+  char *region = mmap_from_system(2 * BUFFER_SIZE);
+  if (!region){
+    return NULL;
+  }
+  char *page = (char *)(((uintptr_t)region + BUFFER_SIZE - 1) & ~(uintptr_t)(BUFFER_SIZE - 1));
+  if (page > region){
+    munmap_to_system(region, page - region);
+  }
+  munmap_to_system(page + BUFFER_SIZE, region + BUFFER_SIZE - page);
+  return page;
+#endif
+}
 
-// This is called at the beginning of each challenge.
-void my_initialize() {
-  for (int i = 0; i < BIN_NUMBER; i++){
-    my_heap.bins[i].dummy_head.size = 0;
-    my_heap.bins[i].dummy_tail.size = 0;
-    my_heap.bins[i].dummy_head.next = &my_heap.bins[i].dummy_tail;
-    my_heap.bins[i].dummy_tail.prev = &my_heap.bins[i].dummy_head;
-    my_heap.bins[i].dummy_tail.next = NULL;
-    my_heap.bins[i].dummy_head.prev = NULL;
+// get one BUFFER_SIZE aligned page: retained resident pages first (emptied ones, then ones of destroyed
+// regions), then the reserve, then purged ones, then a new one. |fresh| tells if it's all zero
+void *map_page(heap_t *heap, bool *fresh){
+  *fresh = false;
+  if (heap->dirty_page_head){
+    page_info_t *page = heap->dirty_page_head;
+    heap->dirty_page_head = page->next;
+    heap->dirty_pages--;
+    TELEMETRY_INC(pages_reused);
+    return page;
+  }
+  if (heap->region_cache){
+    region_chunk_t *chunk = heap->region_cache;
+    heap->region_cache = chunk->next;
+    heap->region_cache_pages--;
+    TELEMETRY_INC(pages_reused);
+    return chunk;
   }
-  my_heap.page_head = NULL;
+  if (heap->reserve_page_head){
+    // only its page_info_t::next was written, and that's overwritten by add_to_page_list
+    page_info_t *page = heap->reserve_page_head;
+    heap->reserve_page_head = page->next;
+    heap->reserve_pages--;
+    *fresh = true;
+    return page;
+  }
+  if (heap->purged_pages){
+    void *page = heap->purged_page_stack[--heap->purged_pages];
+    unpurge_from_system(page, BUFFER_SIZE);
+    heap->mapped_bytes += BUFFER_SIZE;
+    TELEMETRY_INC(pages_reused);
+    return page;
+  }
+  *fresh = true;
+  return map_new_page(heap);
 }
 
-// my_malloc() is called every time an object is allocated.
-// |size| is guaranteed to be a multiple of 8 bytes and meets 8 <= |size| <=
-// 4000. You are not allowed to use any library functions other than
-// mmap_from_system() / munmap_to_system().
-void *my_malloc(size_t size) {
+// give a resident page back to the system: purged (and remembered for map_page()) while there's room,
+// unmapped after that. in arena mode that punches a 4 KiB hole in the arena, purging splits its huge page anyway
+void release_page(heap_t *heap, void *page_start){
+  heap->mapped_bytes -= BUFFER_SIZE;
+  if (heap->purged_pages >= MAX_PURGED_PAGES){
+    munmap_to_system(page_start, BUFFER_SIZE);
+    TELEMETRY_INC(pages_unmapped);
+    return;
+  }
+  purge_to_system(page_start, BUFFER_SIZE);
+  TELEMETRY_INC(pages_purged);
+  heap->purged_page_stack[heap->purged_pages++] = page_start;
+}
+
+// give back a page that has nothing on it anymore,
+// retained (resident, then purged) so that map_page() doesn't need a new mapping
+void unmap_page(heap_t *heap, void *page_start){
+  page_info_t *page = (page_info_t *)page_start;
+  if (heap->dirty_pages < MAX_DIRTY_PAGES){
+    page->next = heap->dirty_page_head;
+    heap->dirty_page_head = page;
+    heap->dirty_pages++;
+    TELEMETRY_INC(pages_retained);
+    return;
+  }
+  release_page(heap, page_start);
+}
+
+// turn what's left of the wilderness into a normal free slot (merged & binned)
+void retire_wilderness(heap_t *heap){
+  char *leftover = heap->wild_ptr;
+  size_t leftover_size = heap->wild_end - heap->wild_ptr;
+  // clear it first, otherwise my_add_to_free_list would hand it right back
+  heap->wild_ptr = NULL;
+  heap->wild_end = NULL;
+  heap->wild_zero = NULL;
+  if (!leftover || leftover_size == 0){
+    return;
+  }
+  TELEMETRY_INC(wilderness_retires);
+  // bump_from_wilderness never leaves less than one metadata+footer+SPLIT_MIN_SIZE bytes behind
+  metadata_t *metadata = (metadata_t *)leftover;
+  metadata->size = leftover_size - sizeof(metadata_t) - sizeof(footer_t);
+  metadata->next = NULL;
+  metadata->prev = NULL;
+  my_add_to_free_list(heap, metadata);
+}
+
+// fast path for bin misses: carve the object from the wilderness,
+// only mapping a new page when the current one can't hold it.
+// |zero_from| (if not NULL) gets where the never written, still zero part of the payload starts
+metadata_t *bump_from_wilderness(heap_t *heap, size_t size, char **zero_from){
+  size_t need = sizeof(metadata_t) + size + sizeof(footer_t);
+  if ((size_t)(heap->wild_end - heap->wild_ptr) < need){
+    retire_wilderness(heap);
+    bool fresh;
+    void *page_start = map_page(heap, &fresh);
+    if (!page_start){// if no more memory in mmap, return null(failed to mmap)
+      return NULL;
+    }
+    add_to_page_list(heap, page_start);
+    heap->wild_ptr = (char *)page_start + sizeof(page_info_t);
+    heap->wild_end = (char *)page_start + BUFFER_SIZE;
+    heap->wild_zero = fresh ? heap->wild_ptr : heap->wild_end;
+  }
+  metadata_t *metadata = (metadata_t *)heap->wild_ptr;
+  size_t remaining_size = heap->wild_end - heap->wild_ptr - need;
+  if (remaining_size < sizeof(metadata_t) + sizeof(footer_t) + SPLIT_MIN_SIZE){
+    // same rule as splitting: a tail too small for a free slot belongs to the object
+    size += remaining_size;
+  }
+  metadata->size = size;
+  metadata->next = NULL;
+  metadata->prev = NULL;
+  set_footer(metadata);
+  find_page(heap, metadata)->used_blocks++;
+  if (zero_from){
+    char *payload = (char *)(metadata + 1);
+    // the footer was just written at the end, so at most up to there
+    *zero_from = heap->wild_zero > payload ? heap->wild_zero : payload;
+    if (*zero_from > payload + size){
+      *zero_from = payload + size;
+    }
+  }
+  heap->wild_ptr += sizeof(metadata_t) + size + sizeof(footer_t);
+  if (heap->wild_ptr > heap->wild_zero){
+    heap->wild_zero = heap->wild_ptr;
+  }
+  TELEMETRY_INC(wilderness_bumps);
+  return metadata;
+}
+
+// a block that doesn't fit in a page (big or very aligned): a mapping of its own,
+// the metadata right before |payload| as usual but |next| is the start of the mapping and
+// |prev| is direct_marker. fresh from mmap, so it's all zero
+metadata_t *map_direct(heap_t *heap, size_t size, size_t alignment){
+  // alignment > 4096: over-map, then trim whole pages off both ends
+  size_t slack = alignment > 4096 ? alignment : 0;
+  size_t length = (sizeof(metadata_t) + (alignment - 1) + size + slack + 4095) & ~(size_t)4095;
+  char *region = mmap_from_system(length);
+  if (!region){
+    return NULL;
+  }
+  char *payload = (char *)(((uintptr_t)region + sizeof(metadata_t) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  char *start = (char *)(((uintptr_t)payload - sizeof(metadata_t)) & ~(uintptr_t)4095);
+  char *end = (char *)(((uintptr_t)payload + size + 4095) & ~(uintptr_t)4095);
+  if (start > region){
+    munmap_to_system(region, start - region);
+  }
+  if (region + length > end){
+    munmap_to_system(end, region + length - end);
+  }
+  metadata_t *metadata = (metadata_t *)payload - 1;
+  metadata->size = size;
+  metadata->next = (metadata_t *)start;
+  metadata->prev = &heap->direct_marker;
+  heap->mapped_bytes += end - start;
+  heap->live_bytes += size;
+  heap->direct_bytes += size;
+  TELEMETRY_INC(direct_maps);
+  return metadata;
+}
+
+void unmap_direct(heap_t *heap, metadata_t *metadata){
+  char *start = (char *)metadata->next;
+  char *end = (char *)(((uintptr_t)(metadata + 1) + metadata->size + 4095) & ~(uintptr_t)4095);
+  heap->live_bytes -= metadata->size;
+  heap->direct_bytes -= metadata->size;
+  heap->mapped_bytes -= end - start;
+  munmap_to_system(start, end - start);
+}
+
+// a page-aligned payload (alignment >= 4096) would need a whole page in front of it for the metadata,
+// so these blocks have none: the mapping is just round_up(size, 4096) starting at the payload, and
+// the metadata (|next| is the payload, |prev| is direct_marker) is kept in aligned_directs instead.
+// they always go in my_heap's table, so my_free() can look them up without touching the memory in front
+
+// the slot |payload| is in, or the empty one it would go to
+metadata_t *aligned_direct_slot(heap_t *heap, void *payload){
+  size_t mask = heap->aligned_direct_slots - 1;
+  size_t i = ((uintptr_t)payload >> 12) * 0x9e3779b97f4a7c15ULL >> 32 & mask;
+  while (heap->aligned_directs[i].next && (void *)heap->aligned_directs[i].next != payload){
+    i = (i + 1) & mask;
+  }
+  return &heap->aligned_directs[i];
+}
+
+// the metadata of a page-aligned direct block, NULL if |ptr| isn't one
+metadata_t *aligned_direct_find(heap_t *heap, void *ptr){
+  if (((uintptr_t)ptr & 4095) || !heap->aligned_direct_count){
+    return NULL;
+  }
+  metadata_t *slot = aligned_direct_slot(heap, ptr);
+  return slot->next ? slot : NULL;
+}
+
+// double the table (256 slots the first time) and put the entries back
+int grow_aligned_directs(heap_t *heap){
+  metadata_t *old = heap->aligned_directs;
+  size_t old_slots = heap->aligned_direct_slots;
+  size_t slots = old_slots ? 2 * old_slots : 256;
+  size_t length = (slots * sizeof(metadata_t) + 4095) & ~(size_t)4095;
+  metadata_t *table = mmap_from_system(length);
+  if (!table){
+    return 0;
+  }
+  heap->aligned_directs = table;
+  heap->aligned_direct_slots = slots;
+  heap->mapped_bytes += length;
+  for (size_t i = 0; i < old_slots; i++){
+    if (old[i].next){
+      *aligned_direct_slot(heap, old[i].next) = old[i];
+    }
+  }
+  if (old){
+    size_t old_length = (old_slots * sizeof(metadata_t) + 4095) & ~(size_t)4095;
+    heap->mapped_bytes -= old_length;
+    munmap_to_system(old, old_length);
+  }
+  return 1;
+}
+
+void *map_aligned_direct(heap_t *heap, size_t size, size_t alignment){
+  if (2 * (heap->aligned_direct_count + 1) > heap->aligned_direct_slots && !grow_aligned_directs(heap)){
+    return NULL;
+  }
+  // over-map by what mmap's own 4096 alignment may miss, then trim whole pages off both ends
+  size_t length = (size + 4095) & ~(size_t)4095;
+  size_t slack = alignment - 4096;
+  char *region = mmap_from_system(length + slack);
+  if (!region){
+    return NULL;
+  }
+  char *payload = (char *)(((uintptr_t)region + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  if (payload > region){
+    munmap_to_system(region, payload - region);
+  }
+  if (region + length + slack > payload + length){
+    munmap_to_system(payload + length, region + length + slack - (payload + length));
+  }
+  metadata_t *slot = aligned_direct_slot(heap, payload);
+  slot->size = size;
+  slot->next = (metadata_t *)payload;
+  slot->prev = &heap->direct_marker;
+  heap->aligned_direct_count++;
+  heap->mapped_bytes += length;
+  heap->live_bytes += size;
+  heap->direct_bytes += size;
+  TELEMETRY_INC(direct_maps);
+  return payload;
+}
+
+// unmap the block and take its slot out of the table, moving back the entries after it
+// that would no longer be found (linear probing without tombstones)
+void unmap_aligned_direct(heap_t *heap, metadata_t *slot){
+  size_t length = (slot->size + 4095) & ~(size_t)4095;
+  heap->live_bytes -= slot->size;
+  heap->direct_bytes -= slot->size;
+  heap->mapped_bytes -= length;
+  munmap_to_system(slot->next, length);
+  size_t mask = heap->aligned_direct_slots - 1;
+  size_t hole = slot - heap->aligned_directs;
+  for (size_t i = (hole + 1) & mask; heap->aligned_directs[i].next; i = (i + 1) & mask){
+    size_t home = ((uintptr_t)heap->aligned_directs[i].next >> 12) * 0x9e3779b97f4a7c15ULL >> 32 & mask;
+    // the entry can move to the hole unless its home is cyclically in (hole, i]
+    if (((i - home) & mask) >= ((i - hole) & mask)){
+      heap->aligned_directs[hole] = heap->aligned_directs[i];
+      hole = i;
+    }
+  }
+  heap->aligned_directs[hole].next = NULL;
+  heap->aligned_direct_count--;
+}
+
+// the old my_free(): merge with free neighbors right away, and hand the page back if it became empty
+void coalesce_and_release(heap_t *heap, metadata_t *metadata){
+  void *ptr = metadata + 1;
+  find_page(heap, metadata)->used_blocks--;
+  // Add the free slot to the free list.
+  my_add_to_free_list(heap, metadata);
+
+  // check munmap merged data
+  // the ptr will remain on the same page whether or not it was merged
+  //(merge only happend within the same page)
+  page_info_t *page = find_page(heap, ptr);
+  if(page && is_empty_page(heap, page)){
+    //remove first metadata from free list
+    void *first_metadata_addr = (char *)page->start_addr + sizeof(page_info_t);
+    //find the first_metadata and remove from free list (not available)
+    metadata_t * first_metadata = (metadata_t *)first_metadata_addr;
+    my_remove_from_free_list(heap, first_metadata);
+    remove_page_from_list(heap, page);
+    // munmap the page
+    unmap_page(heap, page->start_addr);
+  }
+}
+
+// where a quick-listed block keeps the link to the next one (its payload is unused anyway)
+metadata_t **quick_link(metadata_t *metadata){
+  return (metadata_t **)(metadata + 1);
+}
+
+// run the deferred coalescing for everything parked in the quick lists
+void consolidate_quick_lists(heap_t *heap){
+  TELEMETRY_INC(consolidations);
+  for (int i = 0; i < QUICK_LIST_NUMBER; i++){
+    metadata_t *metadata = heap->quick_lists[i];
+    heap->quick_lists[i] = NULL;
+    while (metadata){
+      metadata_t *next = *quick_link(metadata);
+      metadata->prev = NULL;
+      coalesce_and_release(heap, metadata);
+      metadata = next;
+    }
+  }
+  heap->quick_bytes = 0;
+}
+
+// best fit over the bins, then the large-slot tree, NULL if nothing fits
+metadata_t *find_best_fit(heap_t *heap, size_t size){
+#ifdef MY_MALLOC_TELEMETRY
+  size_t visited_before = heap->telemetry.list_nodes_visited + heap->telemetry.tree_nodes_visited;
+#endif
   int bin_idx=get_bin_index(size);
   metadata_t *best_slot=NULL; // a pointer variable to keep watch the current best fit
-  // a for loop check all bins above required size 
-  for (int i = bin_idx; i < BIN_NUMBER; i++){
-    metadata_t *metadata = my_heap.bins[i].dummy_head.next;
-    while (metadata != &my_heap.bins[i].dummy_tail ) {
+  // a for loop check all bins above required size (up to where the tree takes over)
+  for (int i = bin_idx; i < TREE_BIN; i++){
+    metadata_t *metadata = heap->bins[i].dummy_head.next;
+    while (metadata != &heap->bins[i].dummy_tail ) {
+      TELEMETRY_INC(list_nodes_visited);
       if (metadata->size >= size){
-        if (!best_slot || best_slot->size > metadata->size){ 
-          // update best_slot if found a fitter metadata
+        if (!best_slot || best_slot->size > metadata->size ||
+            (best_slot->size == metadata->size && find_page(heap, metadata)->live_bytes > find_page(heap, best_slot)->live_bytes)){
+          // update best_slot if found a fitter metadata (or as fit, on a fuller page)
           best_slot=metadata;
         }
         if (best_slot->size==size){
@@ -282,35 +1136,236 @@ void *my_malloc(size_t size) {
       break;// if find best_slot in current bin size, stop explore larger bins
     }
   }
+  if (!best_slot){
+    best_slot = (metadata_t *)tree_best_fit(heap, size);
+  }
+#ifdef MY_MALLOC_TELEMETRY
+  size_t visited = heap->telemetry.list_nodes_visited + heap->telemetry.tree_nodes_visited - visited_before;
+  int bucket = 0;
+  while (visited && bucket < SEARCH_HISTOGRAM_BUCKETS - 1){
+    visited >>= 1;
+    bucket++;
+  }
+  TELEMETRY_INC(search_length_histogram[bucket]);
+  if (best_slot){
+    TELEMETRY_INC(bin_hits);
+  }else{
+    TELEMETRY_INC(bin_misses);
+  }
+#endif
+  return best_slot;
+}
+
+#ifdef MY_MALLOC_TELEMETRY
+void telemetry_dump(heap_t *heap){
+  telemetry_t *t = &heap->telemetry;
+  heap->telemetry_runs++;
+  printf("[telemetry] my_malloc run #%zu\n", heap->telemetry_runs);
+  printf("[telemetry] quick: hits=%zu misses=%zu frees=%zu | coalesced_frees=%zu consolidations=%zu\n",
+         t->quick_hits, t->quick_misses, t->quick_frees, t->coalesced_frees, t->consolidations);
+  printf("[telemetry] search: hits=%zu misses=%zu list_nodes=%zu tree_nodes=%zu\n",
+         t->bin_hits, t->bin_misses, t->list_nodes_visited, t->tree_nodes_visited);
+  printf("[telemetry] search length histogram (nodes visited):");
+  for (int i = 0; i < SEARCH_HISTOGRAM_BUCKETS; i++){
+    if (i == 0){
+      printf(" 0:%zu", t->search_length_histogram[i]);
+    }else{
+      printf(" %s%zu:%zu", i == SEARCH_HISTOGRAM_BUCKETS - 1 ? ">=" : "<", (size_t)1 << i, t->search_length_histogram[i]);
+    }
+  }
+  printf("\n");
+  printf("[telemetry] blocks: splits=%zu left_merges=%zu right_merges=%zu bumps=%zu wilderness_returns=%zu wilderness_retires=%zu\n",
+         t->splits, t->left_merges, t->right_merges, t->wilderness_bumps, t->wilderness_returns, t->wilderness_retires);
+  printf("[telemetry] find_page: calls=%zu\n", t->find_page_calls);
+  printf("[telemetry] pages: mapped=%zu reused=%zu retained=%zu purged=%zu unmapped=%zu arenas=%zu\n",
+         t->pages_mapped, t->pages_reused, t->pages_retained, t->pages_purged, t->pages_unmapped, t->arenas_mapped);
+  printf("[telemetry] direct_maps=%zu calloc: zeroed_bytes=%zu skipped_bytes=%zu\n",
+         t->direct_maps, t->calloc_zeroed_bytes, t->calloc_skipped_bytes);
+}
+#endif
+
+// Interfaces of malloc (DO NOT RENAME FOLLOWING FUNCTIONS!)
+
+// my_initialize() for any heap (also the ones of my_heap_create())
+void heap_initialize(heap_t *heap) {
+  for (int i = 0; i < BIN_NUMBER; i++){
+    heap->bins[i].dummy_head.size = 0;
+    heap->bins[i].dummy_tail.size = 0;
+    heap->bins[i].dummy_head.next = &heap->bins[i].dummy_tail;
+    heap->bins[i].dummy_tail.prev = &heap->bins[i].dummy_head;
+    heap->bins[i].dummy_tail.next = NULL;
+    heap->bins[i].dummy_head.prev = NULL;
+  }
+  heap->page_head = NULL;
+  heap->wild_ptr = NULL;
+  heap->wild_end = NULL;
+  heap->wild_zero = NULL;
+  for (int i = 0; i < QUICK_LIST_NUMBER; i++){
+    heap->quick_lists[i] = NULL;
+  }
+  heap->quick_bytes = 0;
+  heap->quick_marker.size = 0;
+  heap->quick_marker.next = NULL;
+  heap->quick_marker.prev = NULL;
+  heap->tree_root = NULL;
+  heap->tree_max = NULL;
+  heap->tree_marker.size = 0;
+  heap->tree_marker.next = NULL;
+  heap->tree_marker.prev = NULL;
+  heap->direct_marker.size = 0;
+  heap->direct_marker.next = NULL;
+  heap->direct_marker.prev = NULL;
+  heap->aligned_directs = NULL;
+  heap->aligned_direct_slots = 0;
+  heap->aligned_direct_count = 0;
+  heap->arena_ptr = NULL;
+  heap->arena_end = NULL;
+  heap->dirty_page_head = NULL;
+  heap->dirty_pages = 0;
+  heap->region_cache = NULL;
+  heap->region_cache_pages = 0;
+  heap->reserve_page_head = NULL;
+  heap->reserve_pages = 0;
+  heap->purged_pages = 0;
+  heap->live_bytes = 0;
+  heap->direct_bytes = 0;
+  heap->region_bytes = 0;
+  heap->mapped_bytes = 0;
+  heap->page_count = 0;
+  heap->remote_drains = 0;
+  heap->remote_drained = 0;
+  atomic_store_explicit(&heap->remote_frees, NULL, memory_order_relaxed);
+  for (int i = 0; i < BIN_NUMBER; i++){
+    heap->bin_free_bytes[i] = 0;
+  }
+  for (int i = 0; i < SMALL_SLOT_SIZES; i++){
+    heap->small_free_slots[i] = 0;
+  }
+#ifdef MY_MALLOC_TELEMETRY
+  heap->telemetry = (telemetry_t){0};
+#endif
+}
+
+// This is called at the beginning of each challenge.
+void my_initialize() {
+  heap_initialize(&my_heap);
+}
+
+// owner side of my_free_remote: take the whole pushed list with one exchange and free it,
+// returns the number of blocks freed
+size_t drain_remote_frees(heap_t *heap){
+  if (!atomic_load_explicit(&heap->remote_frees, memory_order_relaxed)){
+    return 0;
+  }
+  metadata_t *metadata = atomic_exchange_explicit(&heap->remote_frees, NULL, memory_order_acquire);
+  size_t count = 0;
+  while (metadata){
+    metadata_t *next = *quick_link(metadata);
+    // (nothing is mapped in front of a page-aligned direct block, so look it up first)
+    metadata_t *slot = aligned_direct_find(heap, metadata + 1);
+    if (slot){
+      unmap_aligned_direct(heap, slot);
+      metadata = next;
+      count++;
+      continue;
+    }
+    if (metadata->prev == &heap->direct_marker){
+      unmap_direct(heap, metadata);
+      metadata = next;
+      count++;
+      continue;
+    }
+    // straight to the bins: a drain brings thousands of blocks at once,
+    // parking them in the quick lists would only run consolidate_quick_lists over and over
+    heap->live_bytes -= metadata->size;
+    find_page(heap, metadata)->live_bytes -= metadata->size;
+    coalesce_and_release(heap, metadata);
+    metadata = next;
+    count++;
+  }
+  heap->remote_drains++;
+  heap->remote_drained += count;
+  return count;
+}
+
+// the biggest block a page can hold, anything bigger goes to map_direct
+#define PAGE_BLOCK_MAX (BUFFER_SIZE - sizeof(page_info_t) - sizeof(metadata_t) - sizeof(footer_t))
 
+// my_malloc() with the zero tracking: |zero_from| (if not NULL) gets where the
+// part of the payload that was never written since its page was mapped starts
+// (the payload end if it's all been written, that's what reused blocks say)
+void *allocate(heap_t *heap, size_t size, char **zero_from) {
+  if (size > PAGE_BLOCK_MAX){
+    // the wilderness and the bins only hold what fits in a page
+    metadata_t *metadata = map_direct(heap, size, 8);
+    if (!metadata){
+      return NULL;
+    }
+    if (zero_from){
+      *zero_from = (char *)(metadata + 1);
+    }
+    return metadata + 1;
+  }
+  if (size <= QUICK_MAX_SIZE){
+    // fast path: reuse a block of exactly this size freed earlier, no search and no split
+    metadata_t **quick_list = &heap->quick_lists[size / 8 - 1];
+    metadata_t *metadata = *quick_list;
+    if (metadata){
+      *quick_list = *quick_link(metadata);
+      metadata->prev = NULL;
+      heap->quick_bytes -= metadata->size;
+      heap->live_bytes += metadata->size;
+      find_page(heap, metadata)->live_bytes += metadata->size;
+      TELEMETRY_INC(quick_hits);
+      if (zero_from){
+        *zero_from = (char *)(metadata + 1) + metadata->size;
+      }
+      return metadata + 1;
+    }
+    TELEMETRY_INC(quick_misses);
+  }
+  metadata_t *best_slot = find_best_fit(heap, size);
+  if (!best_slot && drain_remote_frees(heap)){
+    // blocks came back from other threads, they may have refilled the quick list or a bin
+    return allocate(heap, size, zero_from);
+  }
+  if (!best_slot && heap->quick_bytes){
+    // the bins missed, maybe merging the parked blocks makes room
+    consolidate_quick_lists(heap);
+    best_slot = find_best_fit(heap, size);
+  }
 
   if (!best_slot) {
     // cannot find free slot available in all bins, means we're going to use the new memory immediatly
-    // request a new page region from the system by calling mmap_from_system().
-    void *page_start = mmap_from_system(BUFFER_SIZE);
-    if (!page_start){// if no more memory in mmap, return null(failed to mmap)
+    // bump it from the wilderness (which maps a new page when it runs out),
+    // the object is already sized and footed so there's nothing to split
+    metadata_t *metadata = bump_from_wilderness(heap, size, zero_from);
+    if (!metadata){
       return NULL;
     }
-    add_to_page_list(page_start);
-
-    best_slot = (metadata_t *)((char *)page_start + sizeof(page_info_t));
-    best_slot->size = BUFFER_SIZE - sizeof(page_info_t) - sizeof(metadata_t) - sizeof(footer_t);
-    best_slot->next = NULL;
-    best_slot->prev = NULL;
-    // continue to use the new got metadata
+    heap->live_bytes += metadata->size;
+    find_page(heap, metadata)->live_bytes += metadata->size;
+    return metadata + 1;
   }
   //set footer to the newly allocated memory
-  //(may be greater than required size if remain is smaller than metadata+footer )
+  //(may be greater than required size if remain is smaller than metadata+footer+SPLIT_MIN_SIZE )
   set_footer(best_slot);
   // Remove the best_slot from the free list if it's original in bins
   if (best_slot->next && best_slot->prev){
-    my_remove_from_free_list(best_slot);
+    my_remove_from_free_list(heap, best_slot);
   }
 
   //  ptr: point to right after the metadata itself
   void *ptr = best_slot + 1;
+  page_info_t *page = find_page(heap, best_slot);
+  page->used_blocks++;
+  if (zero_from){
+    // a binned slot has been written before (at least its metadata), don't bother tracking it
+    *zero_from = (char *)ptr + best_slot->size;
+  }
   size_t remaining_size = best_slot->size - size ;
-  if (remaining_size > sizeof(metadata_t) + sizeof(footer_t)) { //add remaining back to free list conditionally
+  if (remaining_size >= sizeof(metadata_t) + sizeof(footer_t) + SPLIT_MIN_SIZE) { //add remaining back to free list conditionally
+    TELEMETRY_INC(splits);
     // If the remaining is smaller than sizeof metadata, the remaining will be taken as a part of the allocated object.
     // currently the best_slot represents an allocated space, so it's size is required size
     best_slot->size = size; 
@@ -324,43 +1379,838 @@ void *my_malloc(size_t size) {
     new_metadata->prev = NULL;
     // Add the remaining free slot to the free list.
     set_footer(new_metadata);
-    my_add_to_free_list(new_metadata);
+    // counted before the split so that the remainder is binned by the page's new fill
+    page->live_bytes += size;
+    my_add_to_free_list(heap, new_metadata);
+    heap->live_bytes += best_slot->size;
+    return ptr;
   } 
+  page->live_bytes += best_slot->size;
+  heap->live_bytes += best_slot->size;
   return ptr;//return start address of required
 }
 
+// my_malloc() is called every time an object is allocated.
+// |size| is guaranteed to be a multiple of 8 bytes and meets 8 <= |size| <=
+// 4000. You are not allowed to use any library functions other than
+// mmap_from_system() / munmap_to_system().
+void *my_malloc(size_t size) {
+  return allocate(&my_heap, size, NULL);
+}
 
-void my_free(void *ptr) {
+// the heap a block was allocated from: in the site-affinity build, the one its page belongs to
+// (or, for a direct mapping, the one whose direct_marker its |prev| points at), otherwise my_heap
+heap_t *heap_of(void *ptr){
+#ifdef MY_MALLOC_SITE_ARENAS
+  if (aligned_direct_find(&my_heap, ptr)){
+    return &my_heap;
+  }
+  metadata_t *metadata = (metadata_t *)ptr - 1;
+  if (metadata->prev){
+    // the block is in use, so |prev| is NULL unless it's a direct mapping
+    return (heap_t *)((char *)metadata->prev - offsetof(heap_t, direct_marker));
+  }
+  // like find_page(), there's no heap to count the call in yet
+  return ((page_info_t *)((uintptr_t)metadata & ~(uintptr_t)(BUFFER_SIZE - 1)))->heap;
+#else
+  (void)ptr;
+  return &my_heap;
+#endif
+}
+
+// my_free() with the heap known
+void heap_free(heap_t *heap, void *ptr) {
   //the size remains unchanged as the size it gives the obj
   // Look up the metadata. The metadata is placed just prior to the object.
   //since the ptr points to the start of object, move it back by one metadata size
+  metadata_t *slot = aligned_direct_find(heap, ptr);
+  if (slot){
+    unmap_aligned_direct(heap, slot);
+    return;
+  }
   metadata_t *metadata = (metadata_t *)ptr - 1;
-  // Add the free slot to the free list.
-  my_add_to_free_list(metadata);
+  if (metadata->prev == &heap->direct_marker){
+    unmap_direct(heap, metadata);
+    return;
+  }
+  heap->live_bytes -= metadata->size;
+  page_info_t *page = find_page(heap, metadata);
+  page->live_bytes -= metadata->size;
+  // only park it if something else stays on the page (otherwise the page could be released)
+  // and the page isn't draining
+  if (metadata->size <= QUICK_MAX_SIZE && page->used_blocks > 1 && page->live_bytes >= SPARSE_PAGE_BYTES){
+    // defer coalescing: park it for the next my_malloc() of the same size
+    metadata_t **quick_list = &heap->quick_lists[metadata->size / 8 - 1];
+    *quick_link(metadata) = *quick_list;
+    metadata->prev = &heap->quick_marker;
+    *quick_list = metadata;
+    heap->quick_bytes += metadata->size;
+    TELEMETRY_INC(quick_frees);
+    if (heap->quick_bytes > QUICK_CONSOLIDATE_BYTES){
+      consolidate_quick_lists(heap);
+    }
+    return;
+  }
+  TELEMETRY_INC(coalesced_frees);
+  coalesce_and_release(heap, metadata);
+}
 
-  // check munmap merged data
-  // the ptr will remain on the same page whether or not it was merged
-  //(merge only happend within the same page)
-  page_info_t *page = find_page(ptr);
-  if(page && is_empty_page(page)){
-    //remove first metadata from free list
-    void *first_metadata_addr = (char *)page->start_addr + sizeof(page_info_t);
-    //find the first_metadata and remove from free list (not available)
-    metadata_t * first_metadata = (metadata_t *)first_metadata_addr;
-    my_remove_from_free_list(first_metadata);
-    remove_page_from_list(page);
-    // munmap the page
-    munmap_to_system(page->start_addr, BUFFER_SIZE);
+void my_free(void *ptr) {
+  heap_free(heap_of(ptr), ptr);
+}
+
+// like aligned_alloc(): |alignment| is a power of two, the block is freed with my_free().
+// over-allocates by up to alignment + one header, then gives the unaligned front and the unused tail
+// back as free slots, so only the metadata of the split is lost (not a whole alignment).
+// blocks that can't fit in a page that way get a mapping of their own
+void *heap_aligned_alloc(heap_t *heap, size_t alignment, size_t size) {
+  if (alignment == 0 || (alignment & (alignment - 1))){
+    return NULL;
+  }
+  size = size ? (size + 7) & ~(size_t)7 : 8;
+  if (alignment <= 8 && size <= PAGE_BLOCK_MAX){
+    return allocate(heap, size, NULL);
+  }
+  // the front gap has to hold a block of its own (metadata + 8 + footer), unless it's empty
+  size_t min_gap = sizeof(metadata_t) + 8 + sizeof(footer_t);
+  size_t padded = size + min_gap + alignment - 8;
+  if (alignment >= 4096 && (alignment > BUFFER_SIZE / 4 || padded > PAGE_BLOCK_MAX)){
+    return map_aligned_direct(&my_heap, size, alignment);
+  }
+  if (alignment > BUFFER_SIZE / 4 || padded > PAGE_BLOCK_MAX){
+    metadata_t *metadata = map_direct(heap, size, alignment < 8 ? 8 : alignment);
+    return metadata ? metadata + 1 : NULL;
+  }
+  // first just enough to align (the common alignment of 16 costs 8 bytes): the gap is
+  // empty, big enough for a block of its own, or goes to the left neighbor
+  char *ptr = allocate(heap, size + alignment - 8, NULL);
+  if (!ptr){
+    return NULL;
+  }
+  metadata_t *metadata = (metadata_t *)ptr - 1;
+  page_info_t *page = find_page(heap, metadata);
+  char *aligned = (char *)(((uintptr_t)ptr + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  if (aligned > ptr && (size_t)(aligned - ptr) < min_gap){
+    // too small for a block: hand it to the left neighbor (in use: it comes back when the
+    // neighbor is freed, free: re-binned a bit bigger), unless there's none or it's in a
+    // quick list (fixed size), then start over with room for a front block
+    metadata_t *left = NULL;
+    if ((char *)metadata != (char *)page + sizeof(page_info_t)){
+      footer_t *left_footer = (footer_t *)((char *)metadata - sizeof(footer_t));
+      left = (metadata_t *)((char *)left_footer - left_footer->size - sizeof(metadata_t));
+    }
+    if (left && left->prev != &heap->quick_marker){
+      size_t gap = aligned - ptr;
+      size_t block_size = metadata->size - gap;
+      metadata = (metadata_t *)aligned - 1;
+      metadata->size = block_size;
+      metadata->next = NULL;
+      metadata->prev = NULL;
+      set_footer(metadata);
+      if (left->next){
+        my_remove_from_free_list(heap, left);
+        left->size += gap;
+        set_footer(left);
+        my_add_to_free_list(heap, left);
+        page->live_bytes -= gap;
+        heap->live_bytes -= gap;
+      }else{
+        left->size += gap;
+        set_footer(left);
+      }
+      ptr = aligned;
+    }else{
+      heap_free(heap, ptr);
+      ptr = allocate(heap, padded, NULL);
+      if (!ptr){
+        return NULL;
+      }
+      metadata = (metadata_t *)ptr - 1;
+      page = find_page(heap, metadata);
+      if ((uintptr_t)ptr % alignment){
+        aligned = (char *)(((uintptr_t)ptr + min_gap + alignment - 1) & ~(uintptr_t)(alignment - 1));
+      }else{
+        aligned = ptr;
+      }
+    }
+  }
+  if (aligned > ptr){
+    // split off the front and free it, the two blocks now have one more metadata + footer
+    size_t gap = aligned - ptr;
+    metadata_t *front = metadata;
+    metadata = (metadata_t *)aligned - 1;
+    metadata->size = front->size - gap;
+    metadata->next = NULL;
+    metadata->prev = NULL;
+    set_footer(metadata);
+    front->size = gap - sizeof(metadata_t) - sizeof(footer_t);
+    set_footer(front);
+    page->used_blocks++;
+    page->live_bytes -= sizeof(metadata_t) + sizeof(footer_t);
+    heap->live_bytes -= sizeof(metadata_t) + sizeof(footer_t);
+    heap_free(heap, front + 1);
+  }
+  size_t tail = metadata->size - size;
+  if (tail >= sizeof(metadata_t) + sizeof(footer_t) + SPLIT_MIN_SIZE){
+    metadata->size = size;
+    set_footer(metadata);
+    metadata_t *rest = (metadata_t *)((char *)(metadata + 1) + size + sizeof(footer_t));
+    rest->size = tail - sizeof(metadata_t) - sizeof(footer_t);
+    rest->next = NULL;
+    rest->prev = NULL;
+    set_footer(rest);
+    page->live_bytes -= tail;
+    heap->live_bytes -= tail;
+    my_add_to_free_list(heap, rest);
+  }
+  return metadata + 1;
+}
+
+void *my_aligned_alloc(size_t alignment, size_t size) {
+  return heap_aligned_alloc(&my_heap, alignment, size);
+}
+
+// like calloc(): zeroes only what may have been written before, a block bumped from a
+// freshly mapped page (or a direct mapping) is zero already
+void *my_calloc(size_t count, size_t size) {
+  heap_t *heap = &my_heap;
+  if (size && count > SIZE_MAX / size){
+    return NULL;
+  }
+  size_t bytes = count * size;
+  bytes = bytes ? (bytes + 7) & ~(size_t)7 : 8;
+  char *zero_from;
+  char *ptr = allocate(heap, bytes, &zero_from);
+  if (!ptr){
+    return NULL;
+  }
+  if (zero_from > ptr + bytes){
+    zero_from = ptr + bytes;
+  }
+  memset(ptr, 0, zero_from - ptr);
+  TELEMETRY_ADD(calloc_zeroed_bytes, zero_from - ptr);
+  TELEMETRY_ADD(calloc_skipped_bytes, ptr + bytes - zero_from);
+  return ptr;
+}
+
+// what the block can hold, at least what was asked for (for realloc and malloc_usable_size)
+size_t my_usable_size(void *ptr) {
+  metadata_t *slot = aligned_direct_find(&my_heap, ptr);
+  if (slot){
+    return slot->size;
+  }
+  return ((metadata_t *)ptr - 1)->size;
+}
+
+#ifdef MY_MALLOC_SITE_ARENAS
+// site-affinity build (preload.c): a heap of its own, for the caller to pick per call site and pass to
+// heap_aligned_alloc(). my_free() gives a block back to the heap it came from
+heap_t *my_heap_create() {
+  heap_t *heap = mmap_from_system((sizeof(heap_t) + 4095) & ~(size_t)4095);
+  if (heap){
+    heap_initialize(heap);
+  }
+  return heap;
+}
+#endif
+
+// map and prefault pages ahead of a burst, so that the my_malloc() calls in it find them resident
+// instead of calling mmap_from_system() and taking a page fault on first touch. the retained resident
+// pages (my_heap_stats().retained_bytes) are used first, so they count: maps pages until reserve + retained pages cover |bytes| and
+// returns what they hold now (reserve + retained bytes, >= |bytes| unless the system said no).
+// my_heap_stats().reserved_bytes is the reserve part alone
+size_t my_reserve(size_t bytes) {
+  heap_t *heap = &my_heap;
+  size_t pages = (bytes + BUFFER_SIZE - 1) / BUFFER_SIZE;
+  while (heap->reserve_pages + heap->dirty_pages + heap->region_cache_pages < pages){
+    page_info_t *page = map_new_page(heap);
+    if (!page){
+      break;
+    }
+    // write (zeros) to every 4096 bytes so the kernel maps them now
+    for (size_t offset = 0; offset < BUFFER_SIZE; offset += 4096){
+      ((volatile char *)page)[offset] = 0;
+    }
+    page->next = heap->reserve_page_head;
+    heap->reserve_page_head = page;
+    heap->reserve_pages++;
+  }
+  return (heap->reserve_pages + heap->dirty_pages + heap->region_cache_pages) * BUFFER_SIZE;
+}
+
+// give the part of the reserve that wasn't used back to the system, returns its size
+size_t my_release_reserve() {
+  heap_t *heap = &my_heap;
+  size_t released = heap->reserve_pages * BUFFER_SIZE;
+  while (heap->reserve_page_head){
+    page_info_t *page = heap->reserve_page_head;
+    heap->reserve_page_head = page->next;
+    heap->reserve_pages--;
+    release_page(heap, page);
+  }
+  return released;
+}
+
+// Regions
+
+// a region starts with one page, its header at the front
+my_region_t *my_region_create() {
+  heap_t *heap = &my_heap;
+  bool fresh;
+  region_chunk_t *chunk = map_page(heap, &fresh);
+  if (!chunk){
+    return NULL;
   }
+  chunk->next = NULL;
+  chunk->size = BUFFER_SIZE;
+  heap->region_bytes += BUFFER_SIZE;
+  my_region_t *region = (my_region_t *)(chunk + 1);
+  region->chunks = chunk;
+  region->pages = 1;
+  region->big_chunks = NULL;
+  region->ptr = (char *)(region + 1);
+  region->end = (char *)chunk + BUFFER_SIZE;
+  region->allocated_bytes = 0;
+  return region;
+}
+
+// the newest page is full: chain a new one, or a mapping of its own if |size| doesn't fit in a page
+// (then the newest page keeps bumping)
+void *region_grow(heap_t *heap, my_region_t *region, size_t size){
+  region_chunk_t *chunk;
+  if (size > BUFFER_SIZE - sizeof(region_chunk_t)){
+    size_t length = (sizeof(region_chunk_t) + size + 4095) & ~(size_t)4095;
+    chunk = mmap_from_system(length);
+    if (!chunk){
+      return NULL;
+    }
+    heap->mapped_bytes += length;
+    chunk->size = length;
+    chunk->next = region->big_chunks;
+    region->big_chunks = chunk;
+  } else {
+    bool fresh;
+    chunk = map_page(heap, &fresh);
+    if (!chunk){
+      return NULL;
+    }
+    chunk->size = BUFFER_SIZE;
+    chunk->next = region->chunks;
+    region->chunks = chunk;
+    region->pages++;
+    region->ptr = (char *)(chunk + 1) + size;
+    region->end = (char *)chunk + BUFFER_SIZE;
+  }
+  heap->region_bytes += chunk->size;
+  region->allocated_bytes += size;
+  return chunk + 1;
+}
+
+// bump allocation, 8-byte aligned. no metadata, no bins, no find_page()
+void *my_region_alloc(my_region_t *region, size_t size) {
+  size = (size + 7) & ~(size_t)7;
+  if ((size_t)(region->end - region->ptr) >= size){
+    void *ptr = region->ptr;
+    region->ptr += size;
+    region->allocated_bytes += size;
+    return ptr;
+  }
+  return region_grow(&my_heap, region, size);
+}
+
+// a no-op: region objects are only given back all together by my_region_destroy(),
+// for callers that free every object anyway
+void my_region_free(my_region_t *region, void *ptr) {
+  (void)region;
+  (void)ptr;
+}
+
+// O(1) for the pages: the whole page chain is spliced onto region_cache (its end is the oldest page, the
+// one holding the region), so the next region or my_malloc takes them back without a syscall or a fault.
+// when the cache can't take them all they go through unmap_page() one by one instead.
+// big chunks are unmapped, one munmap each like the mmap each of them took
+void my_region_destroy(my_region_t *region) {
+  heap_t *heap = &my_heap;
+  region_chunk_t *chunk = region->big_chunks;
+  while (chunk){
+    region_chunk_t *next = chunk->next;
+    heap->region_bytes -= chunk->size;
+    heap->mapped_bytes -= chunk->size;
+    munmap_to_system(chunk, chunk->size);
+    chunk = next;
+  }
+  heap->region_bytes -= region->pages * BUFFER_SIZE;
+  if (heap->region_cache_pages + region->pages <= MAX_REGION_CACHE_PAGES){
+    region_chunk_t *oldest = (region_chunk_t *)region - 1;
+    oldest->next = heap->region_cache;
+    heap->region_cache = region->chunks;
+    heap->region_cache_pages += region->pages;
+    TELEMETRY_ADD(pages_retained, region->pages);
+    return;
+  }
+  chunk = region->chunks;
+  while (chunk){
+    region_chunk_t *next = chunk->next;
+    unmap_page(heap, chunk);
+    chunk = next;
+  }
+}
+
+// my_free() for any thread that doesn't own the heap (malloc.c itself is single threaded, this is
+// the one entry point that may race with the owner): a lock-free push of one CAS, the owner frees
+// the blocks in bulk on its next allocation miss or my_finalize. Multiple producers, one consumer,
+// and the consumer takes everything at once, so there's no ABA. the block goes back to the heap it
+// came from (heap_of), not the one that happens to be my_heap.
+void my_free_remote(void *ptr) {
+  heap_t *heap = heap_of(ptr);
+  metadata_t *metadata = (metadata_t *)ptr - 1;
+  metadata_t *head = atomic_load_explicit(&heap->remote_frees, memory_order_relaxed);
+  do {
+    *quick_link(metadata) = head;
+  } while (!atomic_compare_exchange_weak_explicit(&heap->remote_frees, &head, metadata,
+                                                  memory_order_release, memory_order_relaxed));
+}
+
+// for main.c's producer/consumer benchmark, which doesn't see my_heap_stats_t
+size_t my_remote_drains() {
+  return my_heap.remote_drains;
+}
+
+// unmap every page the heap still has: the ones kept for reuse, what's left of the reserve and the arena,
+// and the pages in the page list (the wilderness page, pages of objects that were never freed), and the
+// page-aligned direct blocks that were never freed.
+// the bins and the wilderness point into them afterwards, so the heap has to start over
+void unmap_all_pages(heap_t *heap){
+  while (heap->reserve_page_head){
+    page_info_t *page = heap->reserve_page_head;
+    heap->reserve_page_head = page->next;
+    heap->reserve_pages--;
+    heap->mapped_bytes -= BUFFER_SIZE;
+    munmap_to_system(page, BUFFER_SIZE);
+  }
+  while (heap->dirty_page_head){
+    page_info_t *page = heap->dirty_page_head;
+    heap->dirty_page_head = page->next;
+    heap->dirty_pages--;
+    heap->mapped_bytes -= BUFFER_SIZE;
+    munmap_to_system(page, BUFFER_SIZE);
+  }
+  while (heap->region_cache){
+    region_chunk_t *chunk = heap->region_cache;
+    heap->region_cache = chunk->next;
+    heap->region_cache_pages--;
+    heap->mapped_bytes -= BUFFER_SIZE;
+    munmap_to_system(chunk, BUFFER_SIZE);
+  }
+  while (heap->purged_pages){
+    void *page = heap->purged_page_stack[--heap->purged_pages];
+    // back into the count first, so it isn't returned twice
+    unpurge_from_system(page, BUFFER_SIZE);
+    munmap_to_system(page, BUFFER_SIZE);
+  }
+  while (heap->page_head){
+    page_info_t *page = heap->page_head;
+    heap->page_head = page->next;
+    heap->page_count--;
+    heap->mapped_bytes -= BUFFER_SIZE;
+    munmap_to_system(page, BUFFER_SIZE);
+  }
+  // page-aligned direct blocks that were never freed, and their table
+  for (size_t i = 0; i < heap->aligned_direct_slots; i++){
+    metadata_t *slot = &heap->aligned_directs[i];
+    if (slot->next){
+      size_t length = (slot->size + 4095) & ~(size_t)4095;
+      heap->live_bytes -= slot->size;
+      heap->direct_bytes -= slot->size;
+      heap->mapped_bytes -= length;
+      munmap_to_system(slot->next, length);
+    }
+  }
+  if (heap->aligned_directs){
+    size_t length = (heap->aligned_direct_slots * sizeof(metadata_t) + 4095) & ~(size_t)4095;
+    heap->mapped_bytes -= length;
+    munmap_to_system(heap->aligned_directs, length);
+  }
+  heap->aligned_directs = NULL;
+  heap->aligned_direct_slots = 0;
+  heap->aligned_direct_count = 0;
+#ifdef MY_MALLOC_HUGE_ARENA
+  // the not yet carved tail of the current arena
+  if (heap->arena_ptr < heap->arena_end){
+    heap->mapped_bytes -= heap->arena_end - heap->arena_ptr;
+    munmap_to_system(heap->arena_ptr, heap->arena_end - heap->arena_ptr);
+  }
+  heap->arena_ptr = NULL;
+  heap->arena_end = NULL;
+#endif
 }
 
 // This is called at the end of each challenge.
+// everything goes back to the system, my_initialize() would forget it anyway
 void my_finalize() {
-  // Nothing is here for now.
-  // feel free to add something if you want!
+  heap_t *heap = &my_heap;
+  drain_remote_frees(heap);
+  consolidate_quick_lists(heap);
+  unmap_all_pages(heap);
+#ifdef MY_MALLOC_TELEMETRY
+  telemetry_dump(heap);
+#endif
+  heap_initialize(heap);
+}
+
+// Introspection (not used by the challenges, for exporting heap health)
+
+// O(1): everything is counted as the heap changes, the largest free block
+// only looks at the tree's max and a bounded number of per-size counters
+my_heap_stats_t my_heap_stats() {
+  heap_t *heap = &my_heap;
+  my_heap_stats_t stats;
+  stats.mapped_bytes = heap->mapped_bytes;
+  stats.live_bytes = heap->live_bytes;
+  stats.direct_bytes = heap->direct_bytes;
+  stats.quick_bytes = heap->quick_bytes;
+  stats.wilderness_bytes = 0;
+  if (heap->wild_end - heap->wild_ptr > (ptrdiff_t)(sizeof(metadata_t) + sizeof(footer_t))){
+    stats.wilderness_bytes = heap->wild_end - heap->wild_ptr - sizeof(metadata_t) - sizeof(footer_t);
+  }
+  stats.retained_bytes = (heap->dirty_pages + heap->region_cache_pages) * BUFFER_SIZE;
+  stats.reserved_bytes = heap->reserve_pages * BUFFER_SIZE;
+  stats.region_bytes = heap->region_bytes;
+  stats.page_count = heap->page_count;
+  stats.remote_drains = heap->remote_drains;
+  stats.remote_drained = heap->remote_drained;
+  stats.free_bytes = stats.quick_bytes + stats.wilderness_bytes;
+  for (int i = 0; i < BIN_NUMBER; i++){
+    stats.bin_free_bytes[i] = heap->bin_free_bytes[i];
+    stats.free_bytes += heap->bin_free_bytes[i];
+  }
+  size_t largest = stats.wilderness_bytes;
+  if (heap->tree_max && heap->tree_max->metadata.size > largest){
+    largest = heap->tree_max->metadata.size;
+  }
+  for (int i = SMALL_SLOT_SIZES - 1; i >= 0 && (size_t)(i + 1) * 8 > largest; i--){
+    if (heap->small_free_slots[i]){
+      largest = (size_t)(i + 1) * 8;
+      break;
+    }
+  }
+  for (int i = QUICK_LIST_NUMBER - 1; i >= 0 && (size_t)(i + 1) * 8 > largest; i--){
+    if (heap->quick_lists[i]){
+      largest = (size_t)(i + 1) * 8;
+      break;
+    }
+  }
+  stats.largest_free_block = largest;
+  stats.fragmentation = stats.free_bytes ? 1.0 - (double)largest / stats.free_bytes : 0.0;
+  return stats;
+}
+
+// call |func| for every block of every page, in address order within a page,
+// by following the metadata sizes from the first metadata to the page end (or the wilderness)
+void my_heap_walk(my_heap_walk_func_t func, void *arg) {
+  heap_t *heap = &my_heap;
+  for (page_info_t *page = heap->page_head; page; page = page->next){
+    char *cursor = (char *)page->start_addr + sizeof(page_info_t);
+    char *page_end = (char *)page->start_addr + BUFFER_SIZE;
+    while (cursor < page_end){
+      my_heap_block_t block;
+      block.page = page->start_addr;
+      block.block = cursor;
+      if (cursor == heap->wild_ptr){
+        block.size = heap->wild_end - heap->wild_ptr;
+        block.footer_size = 0;
+        block.state = HEAP_BLOCK_WILDERNESS;
+        func(&block, arg);
+        break;
+      }
+      metadata_t *metadata = (metadata_t *)cursor;
+      char *next = cursor + sizeof(metadata_t) + metadata->size + sizeof(footer_t);
+      if (next > page_end || next <= cursor){
+        // broken size, don't read past the page: report what's left as one block
+        block.size = page_end - cursor;
+        block.footer_size = 0;
+        block.state = HEAP_BLOCK_IN_USE;
+        func(&block, arg);
+        break;
+      }
+      block.size = metadata->size;
+      block.footer_size = ((footer_t *)(next - sizeof(footer_t)))->size;
+      if (metadata->next && metadata->prev){
+        block.state = HEAP_BLOCK_FREE;
+      }else if (metadata->prev == &heap->quick_marker){
+        block.state = HEAP_BLOCK_QUICK;
+      }else{
+        block.state = HEAP_BLOCK_IN_USE;
+      }
+      if (!func(&block, arg)){
+        return;
+      }
+      cursor = next;
+    }
+  }
+}
+
+// what test_check_block adds up over a walk
+typedef struct test_walk_t {
+  size_t blocks;
+  size_t live_bytes;
+  size_t free_bytes;// bins and tree
+  size_t quick_bytes;
+  size_t wilderness_bytes;
+  size_t page_bytes;// metadata + size + footer of every block, has to tile the pages
+  // the page being walked and what its page_info_t counters should say
+  void *page;
+  size_t page_used_blocks;
+  size_t page_live_bytes;
+} test_walk_t;
+
+void test_check_page(test_walk_t *walk) {
+  if (walk->page){
+    page_info_t *page = (page_info_t *)walk->page;
+    assert(page->used_blocks == walk->page_used_blocks);
+    assert(page->live_bytes == walk->page_live_bytes);
+  }
+  walk->page_used_blocks = 0;
+  walk->page_live_bytes = 0;
+}
+
+bool test_check_block(const my_heap_block_t *block, void *arg) {
+  test_walk_t *walk = (test_walk_t *)arg;
+  walk->blocks++;
+  if (block->page != walk->page){
+    test_check_page(walk);
+    walk->page = block->page;
+  }
+  if (block->state == HEAP_BLOCK_WILDERNESS){
+    assert((char *)block->block + block->size == (char *)block->page + BUFFER_SIZE);
+    walk->page_bytes += block->size;
+    if (block->size > sizeof(metadata_t) + sizeof(footer_t)){
+      walk->wilderness_bytes += block->size - sizeof(metadata_t) - sizeof(footer_t);
+    }
+    return true;
+  }
+  // header and footer agree, and the block is 8-byte aligned
+  assert(block->footer_size == block->size);
+  assert(block->size % 8 == 0);
+  assert((uintptr_t)block->block % 8 == 0);
+  walk->page_bytes += sizeof(metadata_t) + block->size + sizeof(footer_t);
+  if (block->state == HEAP_BLOCK_IN_USE){
+    walk->live_bytes += block->size;
+    walk->page_used_blocks++;
+    walk->page_live_bytes += block->size;
+  }else if (block->state == HEAP_BLOCK_FREE){
+    walk->free_bytes += block->size;
+  }else{
+    walk->quick_bytes += block->size;
+    walk->page_used_blocks++;
+  }
+  return true;
+}
+
+// walk the heap and check it against my_heap_stats()
+void test_check_heap() {
+  test_walk_t walk = {0};
+  my_heap_walk(test_check_block, &walk);
+  test_check_page(&walk);
+  my_heap_stats_t stats = my_heap_stats();
+  assert(walk.page_bytes == stats.page_count * (BUFFER_SIZE - sizeof(page_info_t)));
+  assert(walk.live_bytes + stats.direct_bytes == stats.live_bytes);
+  assert(walk.quick_bytes == stats.quick_bytes);
+  assert(walk.wilderness_bytes == stats.wilderness_bytes);
+  size_t bin_free_bytes = 0;
+  for (int i = 0; i < BIN_NUMBER; i++){
+    bin_free_bytes += stats.bin_free_bytes[i];
+  }
+  assert(walk.free_bytes == bin_free_bytes);
+  assert(stats.free_bytes == walk.free_bytes + walk.quick_bytes + walk.wilderness_bytes);
+  assert(stats.largest_free_block <= stats.free_bytes);
+  assert(stats.mapped_bytes >= stats.page_count * BUFFER_SIZE);
+}
+
+uint64_t test_rand(uint64_t *seed) {
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 7;
+  *seed ^= *seed << 17;
+  return *seed;
 }
 
 void test() {
-  // Implement here!
-  assert(1 == 1); /* 1 is 1. That's always true! (You can remove this.) */
+  // randomized my_malloc/my_free sequences, the heap walker checks every
+  // header/footer pair and the stats after each round.
+  // own generator, so the challenges' rand() sequence stays the same
+  uint64_t seed = 88172645463325252ULL;
+  enum { TEST_OBJECTS = 512, TEST_ROUNDS = 40, TEST_OPS_PER_ROUND = 2000 };
+  void *objects[TEST_OBJECTS] = {0};
+  size_t sizes[TEST_OBJECTS] = {0};
+  my_initialize();
+  test_check_heap();
+  for (int round = 0; round < TEST_ROUNDS; round++){
+    for (int op = 0; op < TEST_OPS_PER_ROUND; op++){
+      test_rand(&seed);
+      int i = seed % TEST_OBJECTS;
+      if (objects[i]){
+        // the object must be intact until it's freed
+        unsigned char *bytes = (unsigned char *)objects[i];
+        assert(bytes[0] == (unsigned char)i && bytes[sizes[i] - 1] == (unsigned char)i);
+        if ((seed >> 24) % 8 == 0){
+          // as if another thread freed it, it comes back on a later allocation miss
+          my_free_remote(objects[i]);
+        }else{
+          my_free(objects[i]);
+        }
+        objects[i] = NULL;
+      }else{
+        // mostly small objects, some up to the max of 4000 bytes
+        size_t max_size = (seed >> 32) % 4 ? 256 : 4000;
+        sizes[i] = ((seed >> 40) % (max_size / 8) + 1) * 8;
+        objects[i] = my_malloc(sizes[i]);
+        assert(objects[i] && (uintptr_t)objects[i] % 8 == 0);
+        memset(objects[i], i, sizes[i]);
+      }
+    }
+    test_check_heap();
+  }
+  // the rounds' remote frees were drained on allocation misses, take the rest too
+  assert(my_heap_stats().remote_drains > 0);
+  drain_remote_frees(&my_heap);
+  // remote frees stay live until the owner drains them (here: my_finalize)
+  size_t remote_bytes = 0;
+  for (int i = 0; i < TEST_OBJECTS; i++){
+    if (objects[i] && i % 2){
+      remote_bytes += ((metadata_t *)objects[i] - 1)->size;
+      my_free_remote(objects[i]);
+    }else if (objects[i]){
+      my_free(objects[i]);
+    }
+  }
+  test_check_heap();
+  assert(my_heap_stats().live_bytes == remote_bytes);
+  my_finalize();
+  test_check_heap();
+  assert(my_heap_stats().live_bytes == 0);
+
+  // more than a page holds gets a mapping of its own
+  unsigned char *big = my_malloc(PAGE_BLOCK_MAX + 8);
+  assert(big && my_heap_stats().direct_bytes == PAGE_BLOCK_MAX + 8);
+  memset(big, 0xff, PAGE_BLOCK_MAX + 8);
+  my_free(big);
+  assert(my_heap_stats().direct_bytes == 0);
+
+  // my_aligned_alloc, from in-page splits up to direct mappings (big or very aligned)
+  static const size_t alignments[] = {16, 64, 256, 1024, 4096, 8192};
+  for (int i = 0; i < TEST_OBJECTS; i++){
+    test_rand(&seed);
+    size_t alignment = alignments[seed % 6];
+    sizes[i] = i % 64 ? ((seed >> 32) % 256 + 1) * 8 : 3 * BUFFER_SIZE;
+    objects[i] = my_aligned_alloc(alignment, sizes[i]);
+    assert(objects[i] && (uintptr_t)objects[i] % alignment == 0);
+    memset(objects[i], i, sizes[i]);
+  }
+  test_check_heap();
+  assert(my_heap_stats().direct_bytes > 0);
+  // a page-aligned block is one page of its own, its metadata is in the table
+  size_t mapped_before_page = my_heap_stats().mapped_bytes;
+  void *page_aligned = my_aligned_alloc(BUFFER_SIZE, 64);
+  assert(page_aligned && (uintptr_t)page_aligned % BUFFER_SIZE == 0 && my_usable_size(page_aligned) == 64);
+  assert(my_heap_stats().mapped_bytes == mapped_before_page + 4096);
+  my_free_remote(page_aligned);
+  drain_remote_frees(&my_heap);
+  assert(my_heap_stats().mapped_bytes == mapped_before_page);
+  for (int i = 0; i < TEST_OBJECTS; i += 2){
+    unsigned char *bytes = (unsigned char *)objects[i];
+    assert(bytes[0] == (unsigned char)i && bytes[sizes[i] - 1] == (unsigned char)i);
+    my_free(objects[i]);
+  }
+  test_check_heap();
+  // my_calloc: zero whether the block is fresh or was dirtied by the frees above,
+  // then dirty it, free it and ask again
+  for (int pass = 0; pass < 2; pass++){
+    for (int i = 0; i < TEST_OBJECTS; i += 2){
+      test_rand(&seed);
+      size_t count = seed % 64 + 1;
+      sizes[i] = count * (i % 64 ? (seed >> 32) % 61 + 1 : BUFFER_SIZE / 16);
+      objects[i] = my_calloc(count, sizes[i] / count);
+      assert(objects[i] && (uintptr_t)objects[i] % 8 == 0);
+      unsigned char *bytes = (unsigned char *)objects[i];
+      for (size_t j = 0; j < sizes[i]; j++){
+        assert(bytes[j] == 0);
+      }
+      memset(objects[i], 0xff, sizes[i]);
+    }
+    test_check_heap();
+    for (int i = 0; i < TEST_OBJECTS; i += 2){
+      my_free(objects[i]);
+    }
+  }
+  for (int i = 1; i < TEST_OBJECTS; i += 2){
+    my_free(objects[i]);
+  }
+  // my_reserve: the pages are mapped up front, used by the next allocations (still zero for
+  // my_calloc) and what's left goes back with my_release_reserve
+#ifndef MY_MALLOC_HUGE_ARENA
+  size_t mapped_before = my_heap_stats().mapped_bytes;
+#endif
+  size_t available = my_reserve(64 * BUFFER_SIZE);
+  size_t reserved = my_heap_stats().reserved_bytes;
+  assert(available >= 64 * BUFFER_SIZE);
+  assert(available == reserved + my_heap_stats().retained_bytes);
+#ifndef MY_MALLOC_HUGE_ARENA
+  // (an arena is counted as mapped as a whole already)
+  assert(my_heap_stats().mapped_bytes == mapped_before + reserved);
+#endif
+  assert(my_reserve(BUFFER_SIZE) == available);// already enough
+  for (int i = 0; i < TEST_OBJECTS / 2; i++){
+    objects[i] = my_calloc(1, PAGE_BLOCK_MAX / 2);
+    unsigned char *bytes = (unsigned char *)objects[i];
+    for (size_t j = 0; j < PAGE_BLOCK_MAX / 2; j++){
+      assert(bytes[j] == 0);
+    }
+  }
+  // more pages than that, so some came from the reserve or the retained ones
+  assert(my_heap_stats().reserved_bytes + my_heap_stats().retained_bytes < available);
+  test_check_heap();
+  size_t left = my_heap_stats().reserved_bytes;
+  assert(my_release_reserve() == left);
+  assert(my_heap_stats().reserved_bytes == 0);
+  test_check_heap();
+  for (int i = 0; i < TEST_OBJECTS / 2; i++){
+    my_free(objects[i]);
+  }
+  // regions: bumped objects that don't overlap (one bigger than a page), all gone at once
+  for (int round = 0; round < 2; round++){
+    my_region_t *region = my_region_create();
+    assert(region);
+    for (int i = 0; i < TEST_OBJECTS; i++){
+      test_rand(&seed);
+      sizes[i] = i == TEST_OBJECTS / 2 ? 2 * BUFFER_SIZE : seed % 300 + 1;
+      objects[i] = my_region_alloc(region, sizes[i]);
+      assert(objects[i] && (uintptr_t)objects[i] % 8 == 0);
+      memset(objects[i], i, sizes[i]);
+      if (i % 3 == 0){
+        my_region_free(region, objects[i]);// no-op, the object stays
+      }
+    }
+    for (int i = 0; i < TEST_OBJECTS; i++){
+      unsigned char *bytes = (unsigned char *)objects[i];
+      assert(bytes[0] == (unsigned char)i && bytes[sizes[i] - 1] == (unsigned char)i);
+    }
+    assert(my_heap_stats().region_bytes > 2 * BUFFER_SIZE);
+    test_check_heap();
+    // the pages are kept resident as a whole if the cache has room (the second round takes them back)
+    bool cached = my_heap.region_cache_pages + region->pages <= MAX_REGION_CACHE_PAGES;
+    size_t expected_retained = my_heap_stats().retained_bytes + region->pages * BUFFER_SIZE;
+    my_region_destroy(region);
+    assert(my_heap_stats().region_bytes == 0);
+    assert(!cached || my_heap_stats().retained_bytes == expected_retained);
+    test_check_heap();
+  }
+  my_finalize();
+  test_check_heap();
+  assert(my_heap_stats().live_bytes == 0 && my_heap_stats().direct_bytes == 0);
+  // and nothing is kept for reuse past my_finalize, not even the wilderness page
+  assert(my_heap_stats().retained_bytes == 0);
+  assert(my_heap_stats().page_count == 0 && my_heap_stats().mapped_bytes == 0);
+  my_reserve(4 * BUFFER_SIZE);
+  my_finalize();
+  assert(my_heap_stats().reserved_bytes == 0);
 }
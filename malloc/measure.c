@@ -0,0 +1,37 @@
+// Runs a command and prints its wall time and the max RSS of the biggest
+// process it ran (like GNU time's %e and %M, which isn't always installed):
+//
+//   ./measure.bin <command> [args...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <command> [args...]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  struct timeval begin, end;
+  gettimeofday(&begin, NULL);
+  pid_t pid = fork();
+  if (pid == 0) {
+    execvp(argv[1], argv + 1);
+    perror(argv[1]);
+    _exit(127);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  gettimeofday(&end, NULL);
+  struct rusage usage;
+  getrusage(RUSAGE_CHILDREN, &usage);
+  fprintf(stderr, "[measure] %.1f ms, user %.1f ms, sys %.1f ms, max RSS %ld KiB\n",
+          (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_usec - begin.tv_usec) / 1e3,
+          usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3,
+          usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3,
+          usage.ru_maxrss);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
@@ -0,0 +1,15 @@
+// One instantiation of policy_malloc.h as my_malloc, picked at build time:
+//   g++ -DPOLICY_HEAP='PolicyHeap<Pow2Classes<32,8>,FirstFit,4096,KeepPages>' ...
+// See the policy_% targets in the Makefile.
+
+#include "policy_malloc.h"
+
+using namespace policy_malloc;
+
+#ifndef POLICY_HEAP
+// Close to malloc.c: power of 2 bins, best fit, 4 KiB pages, a few empty
+// pages retained.
+#define POLICY_HEAP PolicyHeap<Pow2Classes<32, 8>, BestFit, 4096, RetainPages<4>>
+#endif
+
+POLICY_MALLOC_EXPORT(POLICY_HEAP)
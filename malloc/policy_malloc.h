@@ -0,0 +1,418 @@
+// Policy-based allocator template (C++17, header-only).
+//
+// The same free-list design as malloc.c (pages from the system, boundary
+// tags, size-class bins of doubly linked free blocks), with the choices that
+// malloc.c hard-codes lifted into template parameters:
+//
+//   PolicyHeap<SizeClasses, FitPolicy, kPageSize, ReleasePolicy,
+//              CoalescePolicy = Coalesce>
+//
+// Everything is resolved at compile time, so an instantiation costs the same
+// as if it had been written by hand. POLICY_MALLOC_EXPORT(Heap) at the end of
+// this file defines my_initialize / my_malloc / my_free / my_finalize / test
+// for one instantiation, see policy_malloc.cc and the Makefile.
+
+#ifndef POLICY_MALLOC_H
+#define POLICY_MALLOC_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <array>
+#include <utility>
+
+extern "C" {
+void *mmap_from_system(size_t size);
+void munmap_to_system(void *ptr, size_t size);
+}
+
+namespace policy_malloc {
+
+// [Size classes]
+//
+// A size class map is a type with kCount, kLimits (the largest block size of
+// each class; the last class takes everything above) and index(size). The
+// tables are built by constexpr functions.
+
+template <size_t kCount>
+constexpr size_t class_index(const std::array<size_t, kCount> &limits,
+                             size_t size) {
+  size_t low = 0, high = kCount - 1;
+  while (low < high) {
+    size_t mid = (low + high) / 2;
+    if (size <= limits[mid]) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return low;
+}
+
+// Powers of 2 from kMin: (0, kMin], (kMin, 2 kMin], ... like malloc.c's bins.
+template <size_t kMin, size_t kCount_>
+struct Pow2Classes {
+  static constexpr size_t kCount = kCount_;
+  static constexpr std::array<size_t, kCount> make() {
+    std::array<size_t, kCount> limits{};
+    for (size_t i = 0; i < kCount; i++) limits[i] = kMin << i;
+    limits[kCount - 1] = SIZE_MAX;
+    return limits;
+  }
+  static constexpr std::array<size_t, kCount> kLimits = make();
+  static constexpr size_t index(size_t size) {
+    return class_index(kLimits, size);
+  }
+};
+
+// One class per kStep bytes up to kMax, then one for the rest.
+template <size_t kStep, size_t kMax>
+struct LinearClasses {
+  static constexpr size_t kCount = kMax / kStep + 1;
+  static constexpr std::array<size_t, kCount> make() {
+    std::array<size_t, kCount> limits{};
+    for (size_t i = 0; i < kCount; i++) limits[i] = (i + 1) * kStep;
+    limits[kCount - 1] = SIZE_MAX;
+    return limits;
+  }
+  static constexpr std::array<size_t, kCount> kLimits = make();
+  static constexpr size_t index(size_t size) {
+    return class_index(kLimits, size);
+  }
+};
+
+// Powers of 2 from kMin, each split into kSteps equal classes, up to kMax.
+template <size_t kMin, size_t kMax, size_t kSteps>
+struct GeometricClasses {
+  static constexpr size_t count() {
+    size_t n = 1;
+    for (size_t base = kMin; base < kMax; base *= 2) n += kSteps;
+    return n;
+  }
+  static constexpr size_t kCount = count();
+  static constexpr std::array<size_t, kCount> make() {
+    std::array<size_t, kCount> limits{};
+    size_t i = 0;
+    for (size_t base = kMin; base < kMax; base *= 2) {
+      for (size_t s = 1; s <= kSteps; s++) limits[i++] = base + base * s / kSteps;
+    }
+    limits[kCount - 1] = SIZE_MAX;
+    return limits;
+  }
+  static constexpr std::array<size_t, kCount> kLimits = make();
+  static constexpr size_t index(size_t size) {
+    return class_index(kLimits, size);
+  }
+};
+
+// [Fit policies]
+//
+// find(heap, size) returns a free block of at least |size| bytes, or nullptr.
+
+// The first block that fits, from the class of |size| upwards.
+struct FirstFit {
+  template <class Heap>
+  static typename Heap::Block *find(Heap &heap, size_t size) {
+    for (size_t i = Heap::Classes::index(size); i < Heap::Classes::kCount;
+         i++) {
+      for (typename Heap::Block *b = heap.bin(i); b; b = b->next) {
+        if (Heap::size_of(b) >= size) return b;
+      }
+    }
+    return nullptr;
+  }
+};
+
+// The smallest block that fits. Blocks of a higher class are all larger, so
+// only the first class with a fit is searched exhaustively.
+struct BestFit {
+  template <class Heap>
+  static typename Heap::Block *find(Heap &heap, size_t size) {
+    for (size_t i = Heap::Classes::index(size); i < Heap::Classes::kCount;
+         i++) {
+      typename Heap::Block *best = nullptr;
+      for (typename Heap::Block *b = heap.bin(i); b; b = b->next) {
+        size_t s = Heap::size_of(b);
+        if (s >= size && (!best || s < Heap::size_of(best))) {
+          best = b;
+          if (s == size) break;
+        }
+      }
+      if (best) return best;
+    }
+    return nullptr;
+  }
+};
+
+// [Release policies]
+//
+// How many pages that became entirely free stay in the free lists; the
+// others go back to the system right away.
+
+template <size_t kRetain_>
+struct RetainPages {
+  static constexpr size_t kRetain = kRetain_;
+};
+using ReleasePages = RetainPages<0>;
+using KeepPages = RetainPages<SIZE_MAX>;
+
+// [Coalescing policies]
+
+// Merge a freed block with free neighbors right away.
+struct Coalesce {
+  static constexpr bool kEnabled = true;
+};
+// Never merge. Pages then never become free again, so nothing is released
+// before my_finalize.
+struct NoCoalesce {
+  static constexpr bool kEnabled = false;
+};
+
+// [The heap]
+
+template <class SizeClasses, class FitPolicy, size_t kPageSize,
+          class ReleasePolicy, class CoalescePolicy = Coalesce>
+class PolicyHeap {
+ public:
+  using Classes = SizeClasses;
+
+  // |size| is the whole block including the header and the footer, bit 0
+  // is set while in use. |next| and |prev| are only valid while free.
+  struct Block {
+    size_t size;
+    Block *next;
+    Block *prev;
+  };
+
+  // A page is [Page][prologue footer][blocks...][epilogue header]; the
+  // prologue and the epilogue look like used blocks, so merging never walks
+  // out of the page.
+  struct Page {
+    Page *next;
+    Page *prev;
+  };
+
+  static constexpr size_t kUsed = 1;
+  static constexpr size_t kAlign = 8;
+  static constexpr size_t kMinBlock = sizeof(Block) + sizeof(size_t);
+  static constexpr size_t kFirstBlockOffset = sizeof(Page) + sizeof(size_t);
+  static constexpr size_t kPagePayload =
+      kPageSize - kFirstBlockOffset - sizeof(size_t);
+  static_assert(kPageSize % 4096 == 0, "pages come from mmap_from_system");
+
+  // Starts over, handing back whatever a previous run left mapped. The heap
+  // has static storage (POLICY_MALLOC_EXPORT), so |pages_| starts out null.
+  void initialize() { release_all(); }
+
+  void *malloc(size_t size) {
+    size_t need = (size + kAlign - 1) / kAlign * kAlign + 2 * sizeof(size_t);
+    if (need < kMinBlock) need = kMinBlock;
+    if (need > kPagePayload) return nullptr;
+    Block *b = FitPolicy::find(*this, need);
+    if (!b) {
+      add_page();
+      b = FitPolicy::find(*this, need);
+    }
+    unlink(b);
+    size_t size_b = size_of(b);
+    if (size_b == kPagePayload) empty_pages_--;
+    if (size_b - need >= kMinBlock) {
+      Block *rest = (Block *)((char *)b + need);
+      set(rest, size_b - need, 0);
+      link(rest);
+      size_b = need;
+    }
+    set(b, size_b, kUsed);
+    return (char *)b + sizeof(size_t);
+  }
+
+  void free(void *ptr) {
+    if (!ptr) return;
+    Block *b = (Block *)((char *)ptr - sizeof(size_t));
+    size_t size = size_of(b);
+    if (CoalescePolicy::kEnabled) {
+      Block *right = (Block *)((char *)b + size);
+      if (!(right->size & kUsed)) {
+        unlink(right);
+        size += size_of(right);
+      }
+      size_t left_footer = *(size_t *)((char *)b - sizeof(size_t));
+      if (!(left_footer & kUsed)) {
+        b = (Block *)((char *)b - left_footer);
+        unlink(b);
+        size += left_footer;
+      }
+    }
+    set(b, size, 0);
+    if (size == kPagePayload) {
+      if (empty_pages_ >= ReleasePolicy::kRetain) {
+        release_page((Page *)((char *)b - kFirstBlockOffset));
+        return;
+      }
+      empty_pages_++;
+    }
+    link(b);
+  }
+
+  // Like malloc.c, everything goes back to the system: the harness takes
+  // its stats before my_finalize.
+  void finalize() { release_all(); }
+
+  // Hands every page back to the system, including the ones with blocks
+  // still in use, and empties the bins.
+  void release_all() {
+    while (pages_) {
+      Page *page = pages_;
+      pages_ = page->next;
+      munmap_to_system(page, kPageSize);
+    }
+    for (size_t i = 0; i < Classes::kCount; i++) bins_[i] = nullptr;
+    empty_pages_ = 0;
+  }
+
+  Block *bin(size_t i) { return bins_[i]; }
+  static size_t size_of(const Block *b) { return b->size & ~kUsed; }
+
+  // Checks the invariants of every page and bin; returns the number of free
+  // blocks found.
+  size_t check() {
+    size_t free_blocks = 0;
+    for (Page *page = pages_; page; page = page->next) {
+      assert(*(size_t *)((char *)page + sizeof(Page)) == kUsed);
+      char *p = (char *)page + kFirstBlockOffset;
+      bool last_free = false;
+      while (*(size_t *)p != kUsed) {
+        Block *b = (Block *)p;
+        size_t size = size_of(b);
+        assert(size >= kMinBlock && size % kAlign == 0);
+        assert(*(size_t *)(p + size - sizeof(size_t)) == b->size);
+        bool is_free = !(b->size & kUsed);
+        assert(!(CoalescePolicy::kEnabled && is_free && last_free));
+        free_blocks += is_free;
+        last_free = is_free;
+        p += size;
+      }
+      assert(p == (char *)page + kFirstBlockOffset + kPagePayload);
+    }
+    size_t listed = 0;
+    for (size_t i = 0; i < Classes::kCount; i++) {
+      for (Block *b = bins_[i]; b; b = b->next) {
+        assert(!(b->size & kUsed));
+        assert(Classes::index(size_of(b)) == i);
+        assert(!b->next || b->next->prev == b);
+        listed++;
+      }
+    }
+    assert(listed == free_blocks);
+    return free_blocks;
+  }
+
+ private:
+  static void set(Block *b, size_t size, size_t used) {
+    b->size = size | used;
+    *(size_t *)((char *)b + size - sizeof(size_t)) = size | used;
+  }
+
+  void link(Block *b) {
+    Block *&head = bins_[Classes::index(size_of(b))];
+    b->prev = nullptr;
+    b->next = head;
+    if (head) head->prev = b;
+    head = b;
+  }
+
+  void unlink(Block *b) {
+    if (b->prev) {
+      b->prev->next = b->next;
+    } else {
+      bins_[Classes::index(size_of(b))] = b->next;
+    }
+    if (b->next) b->next->prev = b->prev;
+  }
+
+  void add_page() {
+    Page *page = (Page *)mmap_from_system(kPageSize);
+    page->prev = nullptr;
+    page->next = pages_;
+    if (pages_) pages_->prev = page;
+    pages_ = page;
+    *(size_t *)((char *)page + sizeof(Page)) = kUsed;
+    *(size_t *)((char *)page + kPageSize - sizeof(size_t)) = kUsed;
+    Block *b = (Block *)((char *)page + kFirstBlockOffset);
+    set(b, kPagePayload, 0);
+    link(b);
+    empty_pages_++;
+  }
+
+  // |page| is entirely free and its block is not in a bin.
+  void release_page(Page *page) {
+    if (page->prev) {
+      page->prev->next = page->next;
+    } else {
+      pages_ = page->next;
+    }
+    if (page->next) page->next->prev = page->prev;
+    munmap_to_system(page, kPageSize);
+  }
+
+  Block *bins_[Classes::kCount];
+  Page *pages_;
+  size_t empty_pages_;
+};
+
+// Allocates and frees random sizes in random order, checking the contents
+// and the heap invariants along the way.
+template <class Heap>
+void test_heap(Heap &heap) {
+  const int kObjects = 4000;
+  static void *ptrs[kObjects];
+  static size_t sizes[kObjects];
+  uint64_t x = 88172645463325252ULL;
+  auto next = [&]() {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+  };
+  heap.initialize();
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < kObjects; i++) {
+      sizes[i] = next() % 4000 + 1;
+      ptrs[i] = heap.malloc(sizes[i]);
+      assert(ptrs[i] && (uintptr_t)ptrs[i] % 8 == 0);
+      memset(ptrs[i], i & 0xff, sizes[i]);
+    }
+    heap.check();
+    for (int i = kObjects - 1; i > 0; i--) {
+      int j = next() % (i + 1);
+      std::swap(ptrs[i], ptrs[j]);
+      std::swap(sizes[i], sizes[j]);
+    }
+    for (int i = 0; i < kObjects; i++) {
+      unsigned char *p = (unsigned char *)ptrs[i];
+      assert(p[0] == p[sizes[i] - 1]);
+      heap.free(ptrs[i]);
+      if (i % 500 == 0) heap.check();
+    }
+    heap.check();
+  }
+  heap.release_all();
+}
+
+}  // namespace policy_malloc
+
+// Defines the harness interface for one instantiation |Heap|.
+#define POLICY_MALLOC_EXPORT(Heap)                                     \
+  static Heap policy_heap;                                             \
+  extern "C" void my_initialize() { policy_heap.initialize(); }        \
+  extern "C" void *my_malloc(size_t size) {                            \
+    return policy_heap.malloc(size);                                   \
+  }                                                                    \
+  extern "C" void my_free(void *ptr) { policy_heap.free(ptr); }        \
+  extern "C" void my_finalize() { policy_heap.finalize(); }            \
+  extern "C" void test() { policy_malloc::test_heap(policy_heap); }
+
+#endif  // POLICY_MALLOC_H
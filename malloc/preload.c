@@ -0,0 +1,264 @@
+// my_malloc as the process allocator:
+//
+//   make my_malloc.so my_malloc_site.so
+//   LD_PRELOAD=./my_malloc.so bash -c "echo hello"
+//
+// malloc() and friends go to malloc.c under one global lock, so any program
+// can run on it (malloc.c itself is single threaded). Every block is 16-byte
+// aligned like glibc's, blocks bigger than a page get a mapping of their own.
+//
+// my_malloc_site.so is built with MY_MALLOC_SITE_ARENAS: the caller's return
+// address and the power of two size class are hashed into one of the
+// independent heaps, so that objects from the same call site (and of similar
+// size) share pages and pages of short-lived sites empty out together. Code
+// that allocates through a wrapper (xmalloc, operator new) is one site for
+// all its callers, then it's the size class that separates them.
+//
+// With MY_MALLOC_STATS=1 in the environment every process prints its peak
+// mapped bytes and max RSS to stderr at exit.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+void my_initialize();
+void *my_aligned_alloc(size_t alignment, size_t size);
+void my_free(void *ptr);
+size_t my_usable_size(void *ptr);
+#ifdef MY_MALLOC_SITE_ARENAS
+typedef struct heap_t heap_t;
+heap_t *my_heap_create();
+void *heap_aligned_alloc(heap_t *heap, size_t alignment, size_t size);
+#endif
+
+// What glibc guarantees (alignof(max_align_t)).
+#define PRELOAD_ALIGNMENT 16
+
+// The .so is built with -fvisibility=hidden, so that malloc.c's helpers
+// (find_page, my_heap, test, ...) don't interpose on the program's own
+// symbols. Only the malloc family is exported.
+#define EXPORT __attribute__((visibility("default")))
+
+static pthread_mutex_t preload_lock = PTHREAD_MUTEX_INITIALIZER;
+static int preload_initialized;
+static size_t mapped_bytes;
+static size_t peak_mapped_bytes;
+static size_t malloc_count;
+#ifdef MY_MALLOC_SITE_ARENAS
+// The site-affinity heaps, my_free() finds a block's heap by itself.
+static heap_t *site_heaps[MY_MALLOC_SITE_ARENAS];
+#endif
+
+// The interface malloc.c expects from main.c.
+
+void *mmap_from_system(size_t size) {
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    return NULL;
+  }
+  mapped_bytes += size;
+  if (mapped_bytes > peak_mapped_bytes) {
+    peak_mapped_bytes = mapped_bytes;
+  }
+  return ptr;
+}
+
+void munmap_to_system(void *ptr, size_t size) {
+  munmap(ptr, size);
+  mapped_bytes -= size;
+}
+
+void purge_to_system(void *ptr, size_t size) {
+  int ret = -1;
+#ifdef MADV_FREE
+  ret = madvise(ptr, size, MADV_FREE);
+#endif
+  if (ret == -1) {
+    madvise(ptr, size, MADV_DONTNEED);
+  }
+  mapped_bytes -= size;
+}
+
+void unpurge_from_system(void *ptr, size_t size) {
+  mapped_bytes += size;
+  if (mapped_bytes > peak_mapped_bytes) {
+    peak_mapped_bytes = mapped_bytes;
+  }
+}
+
+int advise_hugepage_to_system(void *ptr, size_t size) {
+#ifdef MADV_HUGEPAGE
+  return madvise(ptr, size, MADV_HUGEPAGE) == 0;
+#else
+  return 0;
+#endif
+}
+
+// Called at exit with MY_MALLOC_STATS set.
+static void print_stats() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  char comm[64] = "?";
+  FILE *fp = fopen("/proc/self/comm", "r");
+  if (fp) {
+    if (fgets(comm, sizeof(comm), fp)) {
+      comm[strcspn(comm, "\n")] = 0;
+    }
+    fclose(fp);
+  }
+  char s[256];
+  int n = snprintf(s, sizeof(s),
+                   "[my_malloc] %s (pid %d): %zu mallocs, peak mapped %zu "
+                   "KiB, max RSS %ld KiB\n",
+                   comm, getpid(), malloc_count, peak_mapped_bytes / 1024,
+                   usage.ru_maxrss);
+  write(STDERR_FILENO, s, n);
+}
+
+// A child of fork() gets the lock in the state the forking thread saw.
+static void lock_before_fork() { pthread_mutex_lock(&preload_lock); }
+static void unlock_after_fork() { pthread_mutex_unlock(&preload_lock); }
+
+// Called with the lock held.
+static void initialize() {
+  preload_initialized = 1;
+#ifdef MY_MALLOC_SITE_ARENAS
+  for (size_t i = 0; i < MY_MALLOC_SITE_ARENAS; i++) {
+    site_heaps[i] = my_heap_create();
+  }
+#else
+  my_initialize();
+#endif
+  pthread_atfork(lock_before_fork, unlock_after_fork, unlock_after_fork);
+  if (getenv("MY_MALLOC_STATS")) {
+    atexit(print_stats);
+  }
+}
+
+// Called with the lock held. |site| is the caller's return address.
+static void *allocate(size_t alignment, size_t size, void *site) {
+  if (!preload_initialized) {
+    initialize();
+  }
+  malloc_count++;
+  if (size > SIZE_MAX / 2) {
+    errno = ENOMEM;
+    return NULL;
+  }
+#ifdef MY_MALLOC_SITE_ARENAS
+  // Same site and same power of two size class, same heap.
+  int size_class = size <= 8 ? 0 : 64 - __builtin_clzl(size - 1);
+  uint64_t h = ((uintptr_t)site ^ ((uint64_t)size_class << 48)) *
+               0x9e3779b97f4a7c15ULL;
+  heap_t *heap = site_heaps[(h >> 32) % MY_MALLOC_SITE_ARENAS];
+  if (!heap) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return heap_aligned_alloc(
+      heap, alignment < PRELOAD_ALIGNMENT ? PRELOAD_ALIGNMENT : alignment,
+      size);
+#else
+  (void)site;
+  return my_aligned_alloc(alignment < PRELOAD_ALIGNMENT ? PRELOAD_ALIGNMENT
+                                                        : alignment,
+                          size);
+#endif
+}
+
+// Called with the lock held.
+static void release(void *ptr) { my_free(ptr); }
+
+EXPORT void *malloc(size_t size) {
+  pthread_mutex_lock(&preload_lock);
+  void *ptr = allocate(PRELOAD_ALIGNMENT, size, __builtin_return_address(0));
+  pthread_mutex_unlock(&preload_lock);
+  return ptr;
+}
+
+EXPORT void free(void *ptr) {
+  if (!ptr) return;
+  pthread_mutex_lock(&preload_lock);
+  release(ptr);
+  pthread_mutex_unlock(&preload_lock);
+}
+
+EXPORT void *calloc(size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size) return NULL;
+  pthread_mutex_lock(&preload_lock);
+  // my_calloc() only promises 8-byte alignment, so zero it here.
+  void *ptr = allocate(PRELOAD_ALIGNMENT, count * size,
+                       __builtin_return_address(0));
+  pthread_mutex_unlock(&preload_lock);
+  if (ptr) memset(ptr, 0, count * size);
+  return ptr;
+}
+
+EXPORT void *realloc(void *ptr, size_t size) {
+  if (!ptr) {
+    pthread_mutex_lock(&preload_lock);
+    ptr = allocate(PRELOAD_ALIGNMENT, size, __builtin_return_address(0));
+    pthread_mutex_unlock(&preload_lock);
+    return ptr;
+  }
+  if (!size) {
+    free(ptr);
+    return NULL;
+  }
+  pthread_mutex_lock(&preload_lock);
+  size_t old_size = my_usable_size(ptr);
+  if (size <= old_size) {
+    pthread_mutex_unlock(&preload_lock);
+    return ptr;
+  }
+  void *new_ptr =
+      allocate(PRELOAD_ALIGNMENT, size, __builtin_return_address(0));
+  if (new_ptr) {
+    memcpy(new_ptr, ptr, old_size);
+    release(ptr);
+  }
+  pthread_mutex_unlock(&preload_lock);
+  return new_ptr;
+}
+
+EXPORT void *reallocarray(void *ptr, size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size) return NULL;
+  return realloc(ptr, count * size);
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+  if (!alignment || (alignment & (alignment - 1))) return NULL;
+  pthread_mutex_lock(&preload_lock);
+  void *ptr = allocate(alignment, size, __builtin_return_address(0));
+  pthread_mutex_unlock(&preload_lock);
+  return ptr;
+}
+
+EXPORT void *memalign(size_t alignment, size_t size) {
+  return aligned_alloc(alignment, size);
+}
+
+EXPORT int posix_memalign(void **result, size_t alignment, size_t size) {
+  if (alignment < sizeof(void *) || (alignment & (alignment - 1))) return EINVAL;
+  void *ptr = aligned_alloc(alignment, size);
+  if (!ptr) return ENOMEM;
+  *result = ptr;
+  return 0;
+}
+
+EXPORT void *valloc(size_t size) { return aligned_alloc(4096, size); }
+
+EXPORT void *pvalloc(size_t size) {
+  return aligned_alloc(4096, (size + 4095) & ~(size_t)4095);
+}
+
+EXPORT size_t malloc_usable_size(void *ptr) {
+  return ptr ? my_usable_size(ptr) : 0;
+}
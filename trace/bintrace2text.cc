@@ -0,0 +1,60 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Converts a binary trace written by malloc_challenge_with_trace.bin into the
+visualizer's text format, streaming from stdin to stdout:
+  cat trace1_my.trace | ./bintrace2text.bin [begin [end]] > trace1_my.txt
+Only records in [begin, end) are printed when a range is given.
+
+input format (see malloc/main.c):
+  header: char magic[4] = "MCTR", uint32_t version = 1
+  records: uint64_t ptr, uint32_t size, uint32_t op ('a', 'f', 'm' or 'u')
+*/
+
+struct trace_file_header_t {
+  char magic[4];
+  uint32_t version;
+};
+
+struct trace_record_t {
+  uint64_t ptr;
+  uint32_t size;
+  uint32_t op;
+};
+
+const size_t kRecordsPerRead = 64 * 1024;
+
+int main(int argc, char **argv) {
+  uint64_t range_begin = 0;
+  uint64_t range_end = UINT64_MAX;
+  if (argc >= 2) range_begin = strtoull(argv[1], NULL, 10);
+  if (argc >= 3) range_end = strtoull(argv[2], NULL, 10);
+
+  trace_file_header_t header;
+  if (fread(&header, sizeof(header), 1, stdin) != 1 ||
+      memcmp(header.magic, "MCTR", 4) != 0 || header.version != 1) {
+    fprintf(stderr, "Not a binary malloc trace\n");
+    exit(EXIT_FAILURE);
+  }
+  static trace_record_t records[kRecordsPerRead];
+  uint64_t count = 0;
+  size_t n;
+  while (count < range_end &&
+         (n = fread(records, sizeof(trace_record_t), kRecordsPerRead, stdin)) >
+             0) {
+    for (size_t i = 0; i < n && count < range_end; i++, count++) {
+      if (count < range_begin) continue;
+      const trace_record_t &r = records[i];
+      if (r.op != 'a' && r.op != 'f' && r.op != 'm' && r.op != 'u') {
+        fprintf(stderr, "Unknown op: %u at count %lu\n", r.op, count);
+        exit(EXIT_FAILURE);
+      }
+      printf("%c %lu %u\n", r.op, r.ptr, r.size);
+    }
+  }
+  fprintf(stderr, "count: %lu\n", count);
+  return 0;
+}
@@ -1,12 +1,22 @@
 #include <dlfcn.h>
+#include <execinfo.h>
 #include <fcntl.h>
+#include <malloc.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "hook_shm.h"
+
 static int trace_fd;
 
 void write_uint64_hex(char** wc, uint64_t value) {
@@ -36,6 +46,20 @@ void write_string(char** wc, char* s) {
   **wc = 0;
 }
 
+void write_uint64_dec(char** wc, uint64_t value) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  while (n) {
+    **wc = digits[--n];
+    (*wc)++;
+  }
+  **wc = 0;
+}
+
 void trace_print_malloc(void* p, size_t size) {
   char s[2 + (16 + 1) * 2 + 10];
   char* wc = &s[0];
@@ -69,8 +93,380 @@ void trace_print_realloc(void* new_p, size_t size, void* old_p) {
   write(trace_fd, s, wc - s);
 }
 
+// Sampling heap profiler
+//
+// With HOOK_SAMPLE_BYTES=<n> in the environment, nothing is traced. Instead
+// one allocation per n bytes on average (Poisson sampling, so large
+// allocations are more likely to be picked) records its call stack, and the
+// live and cumulative bytes are aggregated per stack. A profile in the
+// legacy pprof heap format is written to heap_<pid>_<seq>.heap at exit and
+// on SIGUSR2:
+//   HOOK_SAMPLE_BYTES=524288 LD_PRELOAD=./hook.so <command>
+//   pprof --text <command> heap_<pid>_0.heap
+// Unsampled allocations only decrement a thread local counter, and frees
+// only probe the sampled pointers when there are any, so it is cheap enough
+// to leave on.
+//
+// Both tables are fixed size and lock free: slots are claimed with a CAS and
+// counters are atomic adds, so the signal handler can walk them at any time.
+
+#define PROFILE_MAX_DEPTH 32
+#define PROFILE_STACKS 8192  // power of 2
+#define PROFILE_SAMPLES 65536  // power of 2
+#define PROFILE_MAX_PROBES 64
+#define PROFILE_TOMBSTONE 1
+// profile_sample(), profile_malloc() and the hook itself.
+#define PROFILE_SKIP_FRAMES 3
+
+typedef struct {
+  // A stack is identified by the hash of its frames, 0 means an empty slot.
+  uint64_t hash;
+  int depth;
+  void* frames[PROFILE_MAX_DEPTH];
+  int64_t alloc_count;
+  int64_t alloc_bytes;
+  int64_t live_count;
+  int64_t live_bytes;
+} profile_stack_t;
+
+typedef struct {
+  uintptr_t ptr;  // 0: empty, PROFILE_TOMBSTONE: removed
+  profile_stack_t* stack;
+  size_t size;
+} profile_sample_t;
+
+static uint64_t profile_rate;
+static profile_stack_t profile_stacks[PROFILE_STACKS];
+static profile_sample_t profile_samples[PROFILE_SAMPLES];
+static int64_t profile_live_samples;
+static int64_t profile_dropped;
+static int profile_seq;
+static __thread int64_t profile_bytes_until_sample;
+static __thread uint64_t profile_random_state;
+static __thread int profile_busy;
+
+static uint64_t profile_hash(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// The next sampling interval, exponentially distributed with mean
+// profile_rate.
+static int64_t profile_next_interval() {
+  if (!profile_random_state) {
+    profile_random_state =
+        profile_hash((uint64_t)&profile_random_state ^ (uint64_t)time(NULL)) |
+        1;
+  }
+  uint64_t x = profile_random_state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  profile_random_state = x;
+  double u = ((x >> 11) + 1) * (1.0 / 9007199254740992.0);  // (0, 1]
+  return (int64_t)(-log(u) * profile_rate) + 1;
+}
+
+static profile_stack_t* profile_find_stack(void** frames, int depth) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < depth; i++) {
+    hash = profile_hash(hash ^ (uint64_t)frames[i]);
+  }
+  hash |= 1;
+  for (int i = 0; i < PROFILE_MAX_PROBES; i++) {
+    profile_stack_t* s = &profile_stacks[(hash + i) & (PROFILE_STACKS - 1)];
+    uint64_t expected = 0;
+    if (__atomic_load_n(&s->hash, __ATOMIC_ACQUIRE) == hash) {
+      return s;
+    }
+    if (__atomic_compare_exchange_n(&s->hash, &expected, hash, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      for (int j = 0; j < depth; j++) {
+        s->frames[j] = frames[j];
+      }
+      __atomic_store_n(&s->depth, depth, __ATOMIC_RELEASE);
+      return s;
+    }
+    if (expected == hash) {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+static __attribute__((noinline)) void profile_sample(void* p, size_t size) {
+  void* frames[PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES];
+  profile_busy = 1;
+  int depth = backtrace(frames, PROFILE_MAX_DEPTH + PROFILE_SKIP_FRAMES) -
+              PROFILE_SKIP_FRAMES;
+  profile_busy = 0;
+  profile_stack_t* stack =
+      depth > 0 ? profile_find_stack(frames + PROFILE_SKIP_FRAMES, depth)
+                : NULL;
+  if (!stack) {
+    __atomic_fetch_add(&profile_dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  __atomic_fetch_add(&stack->alloc_count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stack->alloc_bytes, size, __ATOMIC_RELAXED);
+  uint64_t h = profile_hash((uint64_t)p);
+  for (int i = 0; i < PROFILE_MAX_PROBES; i++) {
+    profile_sample_t* s = &profile_samples[(h + i) & (PROFILE_SAMPLES - 1)];
+    uintptr_t old = __atomic_load_n(&s->ptr, __ATOMIC_RELAXED);
+    if ((old == 0 || old == PROFILE_TOMBSTONE) &&
+        __atomic_compare_exchange_n(&s->ptr, &old, (uintptr_t)p, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      // |p| is not handed out yet, so nobody looks at these until we return.
+      s->stack = stack;
+      s->size = size;
+      __atomic_fetch_add(&stack->live_count, 1, __ATOMIC_RELAXED);
+      __atomic_fetch_add(&stack->live_bytes, size, __ATOMIC_RELAXED);
+      __atomic_fetch_add(&profile_live_samples, 1, __ATOMIC_RELEASE);
+      return;
+    }
+  }
+  // Counted as allocated but never live.
+  __atomic_fetch_add(&profile_dropped, 1, __ATOMIC_RELAXED);
+}
+
+static __attribute__((noinline)) void profile_malloc(void* p, size_t size) {
+  if (!p || profile_busy) return;
+  profile_bytes_until_sample -= size;
+  if (profile_bytes_until_sample >= 0) return;
+  profile_bytes_until_sample = profile_next_interval();
+  profile_sample(p, size);
+}
+
+// Must be called before |p| goes back to the original allocator, since it
+// may be handed out (and sampled) again right away.
+static void profile_free(void* p) {
+  if (!p || !__atomic_load_n(&profile_live_samples, __ATOMIC_ACQUIRE)) return;
+  uint64_t h = profile_hash((uint64_t)p);
+  for (int i = 0; i < PROFILE_MAX_PROBES; i++) {
+    profile_sample_t* s = &profile_samples[(h + i) & (PROFILE_SAMPLES - 1)];
+    uintptr_t ptr = __atomic_load_n(&s->ptr, __ATOMIC_ACQUIRE);
+    if (ptr == 0) return;
+    if (ptr == (uintptr_t)p) {
+      __atomic_fetch_sub(&s->stack->live_count, 1, __ATOMIC_RELAXED);
+      __atomic_fetch_sub(&s->stack->live_bytes, s->size, __ATOMIC_RELAXED);
+      __atomic_store_n(&s->ptr, PROFILE_TOMBSTONE, __ATOMIC_RELEASE);
+      __atomic_fetch_sub(&profile_live_samples, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+}
+
+static void write_counts(char** wc, int64_t live_count, int64_t live_bytes,
+                         int64_t alloc_count, int64_t alloc_bytes) {
+  write_uint64_dec(wc, live_count);
+  write_string(wc, ": ");
+  write_uint64_dec(wc, live_bytes);
+  write_string(wc, " [");
+  write_uint64_dec(wc, alloc_count);
+  write_string(wc, ": ");
+  write_uint64_dec(wc, alloc_bytes);
+  write_string(wc, "] @");
+}
+
+// Only uses write() and the tables, so it is safe in a signal handler.
+static void profile_dump() {
+  char s[64 + PROFILE_MAX_DEPTH * 19];
+  char* wc = &s[0];
+  write_string(&wc, "heap_");
+  write_uint64_dec(&wc, getpid());
+  write_string(&wc, "_");
+  write_uint64_dec(&wc, __atomic_fetch_add(&profile_seq, 1, __ATOMIC_RELAXED));
+  write_string(&wc, ".heap");
+  int fd = creat(s, 0644);
+  if (fd == -1) {
+    return;
+  }
+
+  int64_t total[4] = {0, 0, 0, 0};
+  for (int i = 0; i < PROFILE_STACKS; i++) {
+    profile_stack_t* stack = &profile_stacks[i];
+    if (!__atomic_load_n(&stack->depth, __ATOMIC_ACQUIRE)) continue;
+    total[0] += __atomic_load_n(&stack->live_count, __ATOMIC_RELAXED);
+    total[1] += __atomic_load_n(&stack->live_bytes, __ATOMIC_RELAXED);
+    total[2] += __atomic_load_n(&stack->alloc_count, __ATOMIC_RELAXED);
+    total[3] += __atomic_load_n(&stack->alloc_bytes, __ATOMIC_RELAXED);
+  }
+  wc = &s[0];
+  write_string(&wc, "heap profile: ");
+  write_counts(&wc, total[0], total[1], total[2], total[3]);
+  write_string(&wc, " heap_v2/");
+  write_uint64_dec(&wc, profile_rate);
+  write_string(&wc, "\n");
+  write(fd, s, wc - s);
+
+  for (int i = 0; i < PROFILE_STACKS; i++) {
+    profile_stack_t* stack = &profile_stacks[i];
+    int depth = __atomic_load_n(&stack->depth, __ATOMIC_ACQUIRE);
+    if (!depth) continue;
+    wc = &s[0];
+    write_counts(&wc, __atomic_load_n(&stack->live_count, __ATOMIC_RELAXED),
+                 __atomic_load_n(&stack->live_bytes, __ATOMIC_RELAXED),
+                 __atomic_load_n(&stack->alloc_count, __ATOMIC_RELAXED),
+                 __atomic_load_n(&stack->alloc_bytes, __ATOMIC_RELAXED));
+    for (int j = 0; j < depth; j++) {
+      write_string(&wc, " 0x");
+      write_uint64_hex(&wc, (uint64_t)stack->frames[j]);
+    }
+    write_string(&wc, "\n");
+    write(fd, s, wc - s);
+  }
+
+  // pprof needs the mappings to symbolize the frames.
+  wc = &s[0];
+  write_string(&wc, "\nMAPPED_LIBRARIES:\n");
+  write(fd, s, wc - s);
+  int maps_fd = open("/proc/self/maps", O_RDONLY);
+  if (maps_fd != -1) {
+    ssize_t n;
+    while ((n = read(maps_fd, s, sizeof(s))) > 0) {
+      write(fd, s, n);
+    }
+    close(maps_fd);
+  }
+  close(fd);
+}
+
+static void profile_signal_handler(int signum) { profile_dump(); }
+
+static void profile_dump_at_exit() {
+  if (profile_rate) {
+    profile_dump();
+  }
+}
+
+static void init_profile(const char* rate) {
+  profile_rate = strtoull(rate, NULL, 10);
+  if (!profile_rate) {
+    fprintf(stderr, "HOOK_SAMPLE_BYTES needs to be a positive number.\n");
+    exit(EXIT_FAILURE);
+  }
+  // backtrace() allocates on its first call, do that before any sampling.
+  void* frames[1];
+  profile_busy = 1;
+  backtrace(frames, 1);
+  profile_busy = 0;
+  signal(SIGUSR2, profile_signal_handler);
+  atexit(profile_dump_at_exit);
+}
+
+// Live counters in shared memory
+//
+// With HOOK_SHM=1 in the environment, nothing is traced. Instead the counters
+// in hook_shm.h are kept in a shared memory segment, so a running process can
+// be watched with `./malloctop.bin <pid>` without any file I/O. Can be
+// combined with HOOK_SAMPLE_BYTES.
+
+static int shm_enabled;
+static hook_shm_t* shm_stats;
+static char shm_name[64];
+
+static void shm_count_alloc(void* p) {
+  size_t size = malloc_usable_size(p);
+  __atomic_fetch_add(&shm_stats->allocated_bytes, size, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&shm_stats->class_allocs[hook_shm_size_class(size)], 1,
+                     __ATOMIC_RELAXED);
+}
+
+static void shm_count_free(void* p) {
+  size_t size = malloc_usable_size(p);
+  __atomic_fetch_add(&shm_stats->freed_bytes, size, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&shm_stats->class_frees[hook_shm_size_class(size)], 1,
+                     __ATOMIC_RELAXED);
+}
+
+static void shm_malloc(void* p) {
+  if (!p) return;
+  __atomic_fetch_add(&shm_stats->mallocs, 1, __ATOMIC_RELAXED);
+  shm_count_alloc(p);
+}
+
+// Must be called before |p| goes back to the original allocator.
+static void shm_free(void* p) {
+  __atomic_fetch_add(&shm_stats->frees, 1, __ATOMIC_RELAXED);
+  shm_count_free(p);
+}
+
+// A fork()ed child inherits the handler, only the owner of the segment
+// unlinks it.
+static void shm_unlink_at_exit() {
+  if (shm_stats && shm_stats->pid == getpid()) {
+    shm_unlink(shm_name);
+  }
+}
+
+// Creates (or truncates) the segment of this process, NULL on failure.
+static hook_shm_t* shm_create() {
+  char* wc = &shm_name[0];
+  write_string(&wc, HOOK_SHM_NAME_PREFIX);
+  write_uint64_dec(&wc, getpid());
+  int fd = shm_open(shm_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd == -1) {
+    return NULL;
+  }
+  if (ftruncate(fd, sizeof(hook_shm_t)) == -1) {
+    close(fd);
+    return NULL;
+  }
+  hook_shm_t* stats = mmap(NULL, sizeof(hook_shm_t), PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+  close(fd);
+  if (stats == MAP_FAILED) {
+    return NULL;
+  }
+  return stats;
+}
+
+// The child of fork() has a copy of the parent's heap but would keep adding
+// to the parent's segment: give it a segment of its own, starting from the
+// parent's counters. If that fails, the child isn't counted.
+static void shm_after_fork_child() {
+  hook_shm_t* parent_stats = shm_stats;
+  shm_stats = NULL;
+  hook_shm_t* stats = shm_create();
+  if (stats) {
+    memcpy(stats, parent_stats, sizeof(hook_shm_t));
+    stats->pid = getpid();
+  }
+  munmap(parent_stats, sizeof(hook_shm_t));
+  shm_stats = stats;
+}
+
+static void init_shm() {
+  // Set first, so that allocations made while setting up are not traced.
+  shm_enabled = 1;
+  hook_shm_t* stats = shm_create();
+  if (!stats) {
+    fprintf(stderr, "init_shm() failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  stats->version = HOOK_SHM_VERSION;
+  stats->pid = getpid();
+  memcpy(stats->magic, HOOK_SHM_MAGIC, sizeof(stats->magic));
+  shm_stats = stats;
+  atexit(shm_unlink_at_exit);
+  pthread_atfork(NULL, NULL, shm_after_fork_child);
+}
+
 static void init_trace_fp() {
-  if (trace_fd) {
+  if (trace_fd || profile_rate || shm_enabled) {
+    return;
+  }
+  char* shm = getenv("HOOK_SHM");
+  char* rate = getenv("HOOK_SAMPLE_BYTES");
+  if (shm) {
+    init_shm();
+  }
+  if (rate) {
+    init_profile(rate);
+  }
+  if (shm || rate) {
     return;
   }
   char s[64];
@@ -92,7 +488,9 @@ void* malloc(size_t size) {
     original_malloc = dlsym(RTLD_NEXT, "malloc");
   }
   void* p = original_malloc(size);
-  trace_print_malloc(p, size);
+  if (shm_stats) shm_malloc(p);
+  if (profile_rate) profile_malloc(p, size);
+  if (trace_fd) trace_print_malloc(p, size);
   return p;
 }
 
@@ -111,13 +509,15 @@ void* calloc(size_t n, size_t elem_size) {
       }
       void* p = &tmp_buffer[tmp_buffer_used];
       tmp_buffer_used += n * elem_size;
-      trace_print_malloc(p, elem_size * n);
+      if (trace_fd) trace_print_malloc(p, elem_size * n);
       return p;
     }
     original_calloc = dlsym(RTLD_NEXT, "calloc");
   }
   void* p = original_calloc(n, elem_size);
-  trace_print_malloc(p, elem_size * n);
+  if (shm_stats) shm_malloc(p);
+  if (profile_rate) profile_malloc(p, elem_size * n);
+  if (trace_fd) trace_print_malloc(p, elem_size * n);
   return p;
 }
 
@@ -132,9 +532,11 @@ void free(void* p) {
       (uint64_t)p < (uint64_t)tmp_buffer + TMP_BUFFER_SIZE) {
     // skip
   } else {
+    if (shm_stats) shm_free(p);
+    if (profile_rate) profile_free(p);
     original_free(p);
   }
-  trace_print_free(p);
+  if (trace_fd) trace_print_free(p);
 }
 
 void* realloc(void* p, size_t size) {
@@ -143,8 +545,26 @@ void* realloc(void* p, size_t size) {
     init_trace_fp();
     original_realloc = dlsym(RTLD_NEXT, "realloc");
   }
+  if (shm_stats) {
+    __atomic_fetch_add(&shm_stats->reallocs, 1, __ATOMIC_RELAXED);
+    if (p) shm_count_free(p);
+  }
+  if (profile_rate) profile_free(p);
   void* new_p = original_realloc(p, size);
-  trace_print_realloc(new_p, size, p);
+  if (shm_stats) {
+    // A failed realloc() keeps |p|.
+    void* live_p = new_p ? new_p : (size ? p : NULL);
+    if (live_p) shm_count_alloc(live_p);
+    // realloc(NULL, n) is a malloc() and realloc(p, 0) that returns NULL a
+    // free(), so that mallocs - frees stays the number of live objects.
+    if (!p && new_p) {
+      __atomic_fetch_add(&shm_stats->mallocs, 1, __ATOMIC_RELAXED);
+    } else if (p && !live_p) {
+      __atomic_fetch_add(&shm_stats->frees, 1, __ATOMIC_RELAXED);
+    }
+  }
+  if (profile_rate) profile_malloc(new_p, size);
+  if (trace_fd) trace_print_realloc(new_p, size, p);
   return new_p;
 }
 
@@ -0,0 +1,37 @@
+#ifndef HOOK_SHM_H
+#define HOOK_SHM_H
+
+#include <stdint.h>
+
+// The counters hook.so publishes with HOOK_SHM=1, in a POSIX shared memory
+// segment named HOOK_SHM_NAME_PREFIX<pid> that malloctop.bin attaches to.
+// Every field is only ever updated with relaxed atomic adds; live bytes and
+// live objects are derived by the reader. Sizes are the usable sizes of the
+// underlying allocator, so that frees can be accounted without a size.
+
+#define HOOK_SHM_NAME_PREFIX "/hook_"
+#define HOOK_SHM_MAGIC "hookshm"
+#define HOOK_SHM_VERSION 1
+// Size class i holds sizes in [2^(i-1), 2^i), the last one everything above.
+#define HOOK_SHM_SIZE_CLASSES 32
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  int32_t pid;
+  uint64_t mallocs;  // malloc(), calloc() and realloc(NULL, n)
+  uint64_t frees;  // free() and realloc(p, 0)
+  uint64_t reallocs;
+  uint64_t allocated_bytes;  // including the new side of realloc()
+  uint64_t freed_bytes;  // including the old side of realloc()
+  uint64_t class_allocs[HOOK_SHM_SIZE_CLASSES];
+  uint64_t class_frees[HOOK_SHM_SIZE_CLASSES];
+} hook_shm_t;
+
+static inline int hook_shm_size_class(uint64_t size) {
+  int size_class = size ? 64 - __builtin_clzll(size) : 0;
+  return size_class < HOOK_SHM_SIZE_CLASSES ? size_class
+                                            : HOOK_SHM_SIZE_CLASSES - 1;
+}
+
+#endif  // HOOK_SHM_H
@@ -0,0 +1,140 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "hook_shm.h"
+
+/*
+Shows the live counters of a process running with
+  HOOK_SHM=1 LD_PRELOAD=./hook.so <command>
+refreshed every interval, until the process exits:
+  ./malloctop.bin <pid> [interval_ms [count]]
+Rates are computed from the difference between two refreshes.
+*/
+
+hook_shm_t read_counters(const hook_shm_t *shm) {
+  hook_shm_t s;
+  memcpy(s.magic, shm->magic, sizeof(s.magic));
+  s.version = shm->version;
+  s.pid = shm->pid;
+  s.mallocs = __atomic_load_n(&shm->mallocs, __ATOMIC_RELAXED);
+  s.frees = __atomic_load_n(&shm->frees, __ATOMIC_RELAXED);
+  s.reallocs = __atomic_load_n(&shm->reallocs, __ATOMIC_RELAXED);
+  s.allocated_bytes = __atomic_load_n(&shm->allocated_bytes, __ATOMIC_RELAXED);
+  s.freed_bytes = __atomic_load_n(&shm->freed_bytes, __ATOMIC_RELAXED);
+  for (int i = 0; i < HOOK_SHM_SIZE_CLASSES; i++) {
+    s.class_allocs[i] = __atomic_load_n(&shm->class_allocs[i], __ATOMIC_RELAXED);
+    s.class_frees[i] = __atomic_load_n(&shm->class_frees[i], __ATOMIC_RELAXED);
+  }
+  return s;
+}
+
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+std::string size_class_label(int i) {
+  char s[48];
+  if (i == 0) {
+    snprintf(s, sizeof(s), "0");
+  } else if (i == HOOK_SHM_SIZE_CLASSES - 1) {
+    snprintf(s, sizeof(s), ">= %llu", 1ULL << (i - 1));
+  } else {
+    snprintf(s, sizeof(s), "%llu-%llu", 1ULL << (i - 1), (1ULL << i) - 1);
+  }
+  return s;
+}
+
+void render(const hook_shm_t &s, const hook_shm_t &last, double dt,
+            int interval_ms) {
+  printf("\x1b[H\x1b[2J");
+  printf("malloctop - pid %d, every %d ms\n\n", s.pid, interval_ms);
+  // Live objects from the size classes like the rows below, they also see
+  // the realloc() sides.
+  uint64_t live_objects = 0;
+  for (int i = 0; i < HOOK_SHM_SIZE_CLASSES; i++) {
+    live_objects += s.class_allocs[i] - s.class_frees[i];
+  }
+  printf("%12s %12s %12s %14s %12s\n", "mallocs/s", "frees/s", "reallocs/s",
+         "live bytes", "live objects");
+  printf("%12.0f %12.0f %12.0f %14lu %12lu\n\n",
+         (s.mallocs - last.mallocs) / dt, (s.frees - last.frees) / dt,
+         (s.reallocs - last.reallocs) / dt, s.allocated_bytes - s.freed_bytes,
+         live_objects);
+
+  uint64_t max_live = 1;
+  for (int i = 0; i < HOOK_SHM_SIZE_CLASSES; i++) {
+    uint64_t live = s.class_allocs[i] - s.class_frees[i];
+    if (live > max_live) max_live = live;
+  }
+  printf("%-24s %12s %12s  %s\n", "size class (bytes)", "allocs/s", "live",
+         "live objects");
+  for (int i = 0; i < HOOK_SHM_SIZE_CLASSES; i++) {
+    uint64_t live = s.class_allocs[i] - s.class_frees[i];
+    if (!s.class_allocs[i]) continue;
+    char bar[41];
+    int width = live * 40 / max_live;
+    memset(bar, '#', width);
+    bar[width] = 0;
+    printf("%-24s %12.0f %12lu  %s\n", size_class_label(i).c_str(),
+           (s.class_allocs[i] - last.class_allocs[i]) / dt, live, bar);
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <pid> [interval_ms [count]]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  int pid = atoi(argv[1]);
+  int interval_ms = argc >= 3 ? atoi(argv[2]) : 1000;
+  int count = argc >= 4 ? atoi(argv[3]) : -1;
+
+  std::string name = HOOK_SHM_NAME_PREFIX + std::to_string(pid);
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd == -1) {
+    fprintf(stderr, "No %s, is the process running with HOOK_SHM=1?\n",
+            name.c_str());
+    exit(EXIT_FAILURE);
+  }
+  void *p = mmap(NULL, sizeof(hook_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "Failed to map %s\n", name.c_str());
+    exit(EXIT_FAILURE);
+  }
+  const hook_shm_t *shm = (const hook_shm_t *)p;
+  if (memcmp(shm->magic, HOOK_SHM_MAGIC, sizeof(shm->magic)) != 0 ||
+      shm->version != HOOK_SHM_VERSION) {
+    fprintf(stderr, "%s is not a hook.so segment of this version\n",
+            name.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  hook_shm_t last = read_counters(shm);
+  double last_time = now();
+  for (int i = 0; count < 0 || i < count; i++) {
+    usleep(interval_ms * 1000);
+    hook_shm_t s = read_counters(shm);
+    double t = now();
+    render(s, last, t - last_time, interval_ms);
+    last = s;
+    last_time = t;
+    if (kill(pid, 0) != 0) {
+      printf("\nprocess %d exited\n", pid);
+      break;
+    }
+  }
+  return 0;
+}
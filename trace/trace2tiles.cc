@@ -0,0 +1,320 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Streams a trace in the visualizer's text format (see visualizer/README.md)
+once and writes what the visualizer needs to scrub through it without
+loading the whole trace:
+
+<out>/index.json
+  shape of the output, plus allocated / mapped bytes at the end of every row
+<out>/tiles/<level>/<y>_<x>.bin
+  the occupancy pyramid. Level 0 has one row per kOpsPerRow ops and one
+  column per kBytesPerColumn bytes, each level above halves both. A tile is
+  kTileSize x kTileSize pixels of 2 bytes: the allocated and the mapped
+  fraction of the pixel * 255, sampled at the end of the row.
+<out>/snapshots/<n>.txt
+  the state before op n * kOpsPerChunk, as a trace (m lines for mapped
+  pages, a lines for live objects)
+<out>/chunks/<n>.txt
+  ops [n * kOpsPerChunk, (n + 1) * kOpsPerChunk). An op that covers pages
+  which are not contiguous after compaction (see below) continues on lines
+  with an upper case op.
+
+Addresses are compacted: every 4096-byte page gets a dense index the first
+time it shows up, so a trace that mmaps all over the address space still
+makes a narrow image. All files use the compacted addresses.
+
+usage:
+  ./bintrace2text.bin < trace5_my.trace | ./trace2tiles.bin tiles5_my
+*/
+
+const uint64_t kPageSize = 4096;
+const uint64_t kOpsPerRow = 256;
+const uint64_t kBytesPerColumn = 256;
+const size_t kTileSize = 256;
+const uint64_t kOpsPerChunk = 64 * 1024;
+
+std::string out_dir;
+
+// Address compaction
+std::unordered_map<uint64_t, uint64_t> dense_pages;
+std::vector<bool> mapped_pages;
+
+// Current state, per level 0 column
+std::vector<int64_t> allocated_bytes;
+std::vector<int64_t> mapped_bytes;
+std::unordered_map<uint64_t, uint64_t> alloc_sizes;
+int64_t allocated_total = 0;
+int64_t mapped_total = 0;
+std::vector<int64_t> allocated_per_row;
+std::vector<int64_t> mapped_per_row;
+
+struct Level {
+  int64_t rows = 0;  // rows already written as tiles
+  size_t columns = 0;
+  std::vector<std::vector<uint8_t>> strip;  // the next row of tiles
+};
+std::vector<Level> levels;
+
+void make_dir(const std::string &path) {
+  if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Failed to create %s\n", path.c_str());
+    exit(EXIT_FAILURE);
+  }
+}
+
+FILE *open_file(const std::string &path) {
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (!fp) {
+    fprintf(stderr, "Failed to open %s\n", path.c_str());
+    exit(EXIT_FAILURE);
+  }
+  return fp;
+}
+
+uint64_t dense_page(uint64_t page) {
+  const auto &it = dense_pages.find(page);
+  if (it != dense_pages.end()) {
+    return it->second;
+  }
+  uint64_t index = dense_pages.size();
+  dense_pages.insert({page, index});
+  mapped_pages.resize(index + 1);
+  allocated_bytes.resize((index + 1) * kPageSize / kBytesPerColumn);
+  mapped_bytes.resize((index + 1) * kPageSize / kBytesPerColumn);
+  return index;
+}
+
+// Calls f(dense_addr, size) for each run of [addr, addr + size) that stays
+// contiguous after compaction.
+template <typename F>
+void for_each_run(uint64_t addr, uint64_t size, F f) {
+  uint64_t run_begin = 0, run_size = 0;
+  for (uint64_t p = addr; p < addr + size;) {
+    uint64_t page_end = (p / kPageSize + 1) * kPageSize;
+    uint64_t piece = std::min(page_end, addr + size) - p;
+    uint64_t dense = dense_page(p / kPageSize) * kPageSize + p % kPageSize;
+    if (run_size && run_begin + run_size == dense) {
+      run_size += piece;
+    } else {
+      if (run_size) f(run_begin, run_size);
+      run_begin = dense;
+      run_size = piece;
+    }
+    p += piece;
+  }
+  if (run_size) f(run_begin, run_size);
+}
+
+void add_to_columns(std::vector<int64_t> &columns, uint64_t begin,
+                    uint64_t size, int64_t sign) {
+  uint64_t end = begin + size;
+  for (uint64_t c = begin / kBytesPerColumn; c * kBytesPerColumn < end; c++) {
+    uint64_t overlap = std::min(end, (c + 1) * kBytesPerColumn) -
+                       std::max(begin, c * kBytesPerColumn);
+    columns[c] += sign * overlap;
+  }
+}
+
+void set_mapped(uint64_t begin, uint64_t size, bool mapped) {
+  for (uint64_t page = begin / kPageSize; page * kPageSize < begin + size;
+       page++) {
+    if (mapped_pages[page] == mapped) continue;
+    mapped_pages[page] = mapped;
+    add_to_columns(mapped_bytes, page * kPageSize, kPageSize, mapped ? 1 : -1);
+    mapped_total += mapped ? kPageSize : -kPageSize;
+  }
+}
+
+void write_tiles(int level_index) {
+  Level &level = levels[level_index];
+  std::string dir = out_dir + "/tiles/" + std::to_string(level_index);
+  make_dir(dir);
+  int64_t y = level.rows / kTileSize;
+  std::vector<uint8_t> tile(kTileSize * kTileSize * 2);
+  for (size_t x = 0; x * kTileSize < level.columns; x++) {
+    std::fill(tile.begin(), tile.end(), 0);
+    for (size_t r = 0; r < level.strip.size(); r++) {
+      const std::vector<uint8_t> &row = level.strip[r];
+      for (size_t c = 0; c < kTileSize && (x * kTileSize + c) * 2 < row.size();
+           c++) {
+        tile[(r * kTileSize + c) * 2] = row[(x * kTileSize + c) * 2];
+        tile[(r * kTileSize + c) * 2 + 1] = row[(x * kTileSize + c) * 2 + 1];
+      }
+    }
+    FILE *fp = open_file(dir + "/" + std::to_string(y) + "_" +
+                         std::to_string(x) + ".bin");
+    fwrite(tile.data(), 1, tile.size(), fp);
+    fclose(fp);
+  }
+}
+
+void push_row(int level_index, std::vector<uint8_t> row);
+
+// Writes the pending strip of |level_index| and, unless it is the top level,
+// averages it 2x2 into the level above.
+void flush_strip(int level_index, bool downsample) {
+  write_tiles(level_index);
+  std::vector<std::vector<uint8_t>> strip;
+  strip.swap(levels[level_index].strip);
+  levels[level_index].rows += strip.size();
+  if (!downsample) return;
+  for (size_t r = 0; r < strip.size(); r += 2) {
+    const std::vector<uint8_t> &a = strip[r];
+    const std::vector<uint8_t> &b = r + 1 < strip.size() ? strip[r + 1] : a;
+    size_t columns = (std::max(a.size(), b.size()) / 2 + 1) / 2;
+    std::vector<uint8_t> row(columns * 2);
+    for (size_t c = 0; c < columns; c++) {
+      for (int ch = 0; ch < 2; ch++) {
+        int sum = 0;
+        for (size_t i = (c * 2) * 2 + ch; i < (c * 2 + 2) * 2; i += 2) {
+          if (i < a.size()) sum += a[i];
+          if (i < b.size()) sum += b[i];
+        }
+        row[c * 2 + ch] = sum / 4;
+      }
+    }
+    push_row(level_index + 1, row);
+  }
+}
+
+void push_row(int level_index, std::vector<uint8_t> row) {
+  if ((int)levels.size() <= level_index) levels.resize(level_index + 1);
+  Level &level = levels[level_index];
+  level.columns = std::max(level.columns, row.size() / 2);
+  level.strip.push_back(std::move(row));
+  if (level.strip.size() == kTileSize) flush_strip(level_index, true);
+}
+
+void end_row() {
+  std::vector<uint8_t> row(allocated_bytes.size() * 2);
+  for (size_t c = 0; c < allocated_bytes.size(); c++) {
+    row[c * 2] = allocated_bytes[c] * 255 / kBytesPerColumn;
+    row[c * 2 + 1] = mapped_bytes[c] * 255 / kBytesPerColumn;
+  }
+  allocated_per_row.push_back(allocated_total);
+  mapped_per_row.push_back(mapped_total);
+  push_row(0, std::move(row));
+}
+
+void write_snapshot(uint64_t chunk) {
+  FILE *fp = open_file(out_dir + "/snapshots/" + std::to_string(chunk) +
+                       ".txt");
+  for (uint64_t page = 0; page < mapped_pages.size();) {
+    if (!mapped_pages[page]) {
+      page++;
+      continue;
+    }
+    uint64_t begin = page;
+    while (page < mapped_pages.size() && mapped_pages[page]) page++;
+    fprintf(fp, "m %lu %lu\n", begin * kPageSize, (page - begin) * kPageSize);
+  }
+  for (const auto &it : alloc_sizes) {
+    for_each_run(it.first, it.second, [fp](uint64_t addr, uint64_t size) {
+      fprintf(fp, "a %lu %lu\n", addr, size);
+    });
+  }
+  fclose(fp);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <out_dir> < trace.txt\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  out_dir = argv[1];
+  make_dir(out_dir);
+  make_dir(out_dir + "/tiles");
+  make_dir(out_dir + "/snapshots");
+  make_dir(out_dir + "/chunks");
+
+  char op;
+  uint64_t addr, size;
+  uint64_t count = 0;
+  FILE *chunk_fp = NULL;
+  while (scanf(" %c %lu %lu", &op, &addr, &size) == 3) {
+    if (count % kOpsPerChunk == 0) {
+      if (chunk_fp) fclose(chunk_fp);
+      write_snapshot(count / kOpsPerChunk);
+      chunk_fp = open_file(out_dir + "/chunks/" +
+                           std::to_string(count / kOpsPerChunk) + ".txt");
+    }
+    if (op == 'f') {
+      const auto &it = alloc_sizes.find(addr);
+      if (it == alloc_sizes.end()) {
+        fprintf(stderr, "Addr 0x%lX is being freed but not allocated\n", addr);
+        exit(EXIT_FAILURE);
+      }
+      size = it->second;
+      alloc_sizes.erase(it);
+    } else if (op == 'a') {
+      alloc_sizes.insert({addr, size});
+    } else if (op != 'm' && op != 'u') {
+      fprintf(stderr, "Unknown op: %c at count %lu\n", op, count);
+      exit(EXIT_FAILURE);
+    }
+    char line_op = op;
+    for_each_run(addr, size, [&](uint64_t begin, uint64_t run_size) {
+      if (op == 'a' || op == 'f') {
+        add_to_columns(allocated_bytes, begin, run_size, op == 'a' ? 1 : -1);
+        allocated_total += op == 'a' ? run_size : -run_size;
+      } else {
+        set_mapped(begin, run_size, op == 'm');
+      }
+      fprintf(chunk_fp, "%c %lu %lu\n", line_op, begin, run_size);
+      line_op = op - 'a' + 'A';
+    });
+    count++;
+    if (count % kOpsPerRow == 0) end_row();
+  }
+  if (chunk_fp) fclose(chunk_fp);
+  if (count % kOpsPerRow) end_row();
+
+  // Flush the partial strips upwards until one tile covers a whole level.
+  for (int l = 0; l < (int)levels.size(); l++) {
+    Level &level = levels[l];
+    bool top = level.rows + level.strip.size() <= kTileSize &&
+               level.columns <= kTileSize;
+    if (!level.strip.empty() || level.rows == 0) flush_strip(l, !top);
+    if (top) {
+      levels.resize(l + 1);
+      break;
+    }
+  }
+
+  FILE *fp = open_file(out_dir + "/index.json");
+  fprintf(fp,
+          "{\"ops\": %lu, \"ops_per_row\": %lu, \"bytes_per_column\": %lu, "
+          "\"tile_size\": %zu, \"ops_per_chunk\": %lu, \"range_size\": %lu,\n",
+          count, kOpsPerRow, kBytesPerColumn, kTileSize, kOpsPerChunk,
+          dense_pages.size() * kPageSize);
+  fprintf(fp, "\"levels\": [");
+  for (size_t l = 0; l < levels.size(); l++) {
+    fprintf(fp, "%s{\"rows\": %ld, \"columns\": %zu}", l ? ", " : "",
+            levels[l].rows, levels[l].columns);
+  }
+  fprintf(fp, "],\n\"allocated\": [");
+  for (size_t i = 0; i < allocated_per_row.size(); i++) {
+    fprintf(fp, "%s%ld", i ? ", " : "", allocated_per_row[i]);
+  }
+  fprintf(fp, "],\n\"mapped\": [");
+  for (size_t i = 0; i < mapped_per_row.size(); i++) {
+    fprintf(fp, "%s%ld", i ? ", " : "", mapped_per_row[i]);
+  }
+  fprintf(fp, "]}\n");
+  fclose(fp);
+
+  fprintf(stderr, "count: %lu\n", count);
+  fprintf(stderr, "range_size: %lu\n", dense_pages.size() * kPageSize);
+  fprintf(stderr, "levels: %zu\n", levels.size());
+  return 0;
+}
@@ -1,8 +1,18 @@
+#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <limits>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 std::unordered_map<int64_t, int64_t> alloc_sizes;
 int64_t peak_size = 0;
@@ -10,6 +20,7 @@ int64_t resident_size = 0;
 int64_t allocation_size_accumlated = 0;
 int64_t free_size_accumlated = 0;
 FILE *trace_fp;
+int64_t count_all = 0;
 int64_t range_begin = std::numeric_limits<int64_t>::max();
 int64_t range_end = std::numeric_limits<int64_t>::min();
 
@@ -49,7 +60,367 @@ void record_free(int64_t addr) {
   trace_op('f', addr, size);
 }
 
-int main() {
+void print_summary() {
+  fprintf(stderr, "count: %ld\n", count_all);
+  fprintf(stderr, "peak_size: %ld\n", peak_size);
+  fprintf(stderr, "resident_size at last: %ld\n", resident_size);
+  fprintf(stderr, "allocation_size_accumlated: %ld\n",
+      allocation_size_accumlated);
+  fprintf(stderr, "range_begin: %ld\n",
+          range_begin);
+  fprintf(stderr, "range_end: %ld\n",
+          range_end);
+  fprintf(stderr, "range_size: %ld\n",
+          range_end - range_begin);
+}
+
+/*
+Parallel mode:
+  ./trace2timeline.bin [--threads=N] <trace file> > <timeline>
+The file is split into chunks at line boundaries, and every chunk is read
+twice on a pool of N threads (the number of cores by default):
+1. Each chunk matches the frees of objects allocated in the chunk itself,
+   and remembers the frees it could not match and the objects still live at
+   its end. The first allocation of an address in a chunk is kept apart: if
+   an earlier chunk allocated the address and nobody freed it, the sequential
+   mode keeps the old size (alloc_sizes.insert() doesn't overwrite).
+2. Sequentially, in order, those first allocations and then the unmatched
+   frees of a chunk are looked up in the objects live at the end of the
+   chunks before it. This only touches the first allocations, the unmatched
+   frees and the live objects, not every op.
+3. Now that every chunk knows its free sizes and the resident size it starts
+   with, each one formats its part of the timeline and trace.txt, and its
+   peak and range. Chunks are written out in order, a batch at a time.
+The output is the same as the sequential mode, byte for byte.
+*/
+
+struct Op {
+  char op;
+  int64_t addr;
+  int64_t size;
+  int64_t old_addr;
+};
+
+// An address a chunk has seen in pass 1.
+struct Seen {
+  int64_t size;  // -1: freed (by the chunk, or an unmatched free)
+  // Allocated by the chunk before anything else happened to the address, and
+  // not freed since.
+  bool first;
+};
+
+struct Chunk {
+  const char *begin;
+  const char *end;
+  // Pass 1
+  int64_t count = 0;
+  int64_t allocated = 0;
+  int64_t matched_freed = 0;
+  std::vector<int64_t> unmatched_frees;  // addresses, in order
+  std::unordered_map<int64_t, Seen> live;  // addr -> state at the end
+  // First allocations (see Seen::first) the chunk freed itself.
+  std::vector<std::pair<int64_t, int64_t>> first_freed;  // addr, size
+  // Pass 2
+  std::vector<int64_t> unmatched_sizes;  // -1: freed but not allocated
+  // addr -> the older size a first allocation keeps
+  std::unordered_map<int64_t, int64_t> reallocated;
+  int64_t start_count = 0;
+  int64_t start_resident = 0;
+  int64_t start_allocated = 0;
+  int64_t start_freed = 0;
+  // Pass 3
+  std::string timeline;
+  std::string trace;
+  int64_t peak = 0;
+  int64_t range_begin = std::numeric_limits<int64_t>::max();
+  int64_t range_end = std::numeric_limits<int64_t>::min();
+};
+
+static inline void skip_spaces(const char *&p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\n' || *p == '\t' || *p == '\r')) p++;
+}
+
+static inline bool parse_hex(const char *&p, const char *end, int64_t &value) {
+  skip_spaces(p, end);
+  uint64_t v = 0;
+  const char *begin = p;
+  for (; p < end; p++) {
+    char c = *p;
+    if ('0' <= c && c <= '9') {
+      v = v * 16 + (c - '0');
+    } else if ('A' <= c && c <= 'F') {
+      v = v * 16 + (c - 'A' + 10);
+    } else if ('a' <= c && c <= 'f') {
+      v = v * 16 + (c - 'a' + 10);
+    } else {
+      break;
+    }
+  }
+  value = (int64_t)v;
+  return p != begin;
+}
+
+// Parses the next op in [p, end), like the scanf()s of the sequential mode.
+static bool parse_op(const char *&p, const char *end, Op &op, int64_t count) {
+  skip_spaces(p, end);
+  if (p == end) return false;
+  op.op = *p++;
+  if (!parse_hex(p, end, op.addr)) return false;
+  if (op.op == 'a') {
+    if (!parse_hex(p, end, op.size)) {
+      printf("Failed to read size for alloc");
+      exit(EXIT_FAILURE);
+    }
+  } else if (op.op == 'r') {
+    if (!parse_hex(p, end, op.size) || !parse_hex(p, end, op.old_addr)) {
+      printf("Failed to read size and old_addr for realloc");
+      exit(EXIT_FAILURE);
+    }
+  } else if (op.op != 'f') {
+    printf("Unknown op: %c at count %ld\n", op.op, count);
+    exit(EXIT_FAILURE);
+  }
+  return true;
+}
+
+void match_chunk(Chunk &chunk) {
+  std::unordered_map<int64_t, Seen> &live = chunk.live;
+  Op op;
+  const char *p = chunk.begin;
+  auto free_addr = [&](int64_t addr) {
+    const auto &it = live.insert({addr, {-1, false}}).first;
+    Seen &seen = it->second;
+    if (seen.size < 0) {
+      chunk.unmatched_frees.push_back(addr);
+      return;
+    }
+    chunk.matched_freed += seen.size;
+    if (seen.first) chunk.first_freed.push_back({addr, seen.size});
+    seen = {-1, false};
+  };
+  auto alloc = [&](int64_t addr, int64_t size) {
+    chunk.allocated += size;
+    const auto &inserted = live.insert({addr, {size, true}});
+    Seen &seen = inserted.first->second;
+    if (!inserted.second && seen.size < 0) seen.size = size;
+  };
+  while (parse_op(p, chunk.end, op, chunk.count)) {
+    if (op.op == 'a') {
+      alloc(op.addr, op.size);
+    } else if (op.op == 'r') {
+      if (op.old_addr) free_addr(op.old_addr);
+      alloc(op.addr, op.size);
+    } else {
+      free_addr(op.addr);
+    }
+    chunk.count++;
+  }
+}
+
+void resolve_chunk(Chunk &chunk, std::unordered_map<int64_t, int64_t> &live) {
+  int64_t freed = chunk.matched_freed;
+  // Returns the size alloc_sizes holds after the chunk's first allocation at
+  // |addr|: an older object there that was never freed keeps its size, and
+  // it belongs to the chunk from now on.
+  auto first_alloc = [&](int64_t addr, int64_t size) {
+    const auto &it = live.find(addr);
+    if (it == live.end()) return size;
+    int64_t old_size = it->second;
+    live.erase(it);
+    chunk.reallocated.insert({addr, old_size});
+    return old_size;
+  };
+  for (const auto &it : chunk.first_freed) {
+    freed += first_alloc(it.first, it.second) - it.second;
+  }
+  for (auto &it : chunk.live) {
+    if (it.second.first) it.second.size = first_alloc(it.first, it.second.size);
+  }
+  for (int64_t addr : chunk.unmatched_frees) {
+    const auto &it = live.find(addr);
+    if (it == live.end()) {
+      chunk.unmatched_sizes.push_back(-1);
+      continue;
+    }
+    chunk.unmatched_sizes.push_back(it->second);
+    freed += it->second;
+    live.erase(it);
+  }
+  for (const auto &it : chunk.live) {
+    if (it.second.size >= 0) live.insert({it.first, it.second.size});
+  }
+  chunk.live.clear();
+  chunk.first_freed.clear();
+  // The start of the next chunk.
+  count_all += chunk.count;
+  allocation_size_accumlated += chunk.allocated;
+  free_size_accumlated += freed;
+  resident_size += chunk.allocated - freed;
+}
+
+void format_chunk(Chunk &chunk) {
+  std::unordered_map<int64_t, int64_t> live;
+  size_t next_unmatched = 0;
+  int64_t count = chunk.start_count;
+  int64_t resident = chunk.start_resident;
+  int64_t last_resident = resident;
+  int64_t allocated = chunk.start_allocated;
+  int64_t freed = chunk.start_freed;
+  char line[128];
+  auto trace = [&](char op, int64_t addr, int64_t size) {
+    int n = snprintf(line, sizeof(line), "%c %ld %ld\n", op, addr, size);
+    chunk.trace.append(line, n);
+    chunk.range_begin = std::min(chunk.range_begin, addr);
+    chunk.range_end = std::max(chunk.range_end, addr + size);
+  };
+  auto free_addr = [&](int64_t addr) {
+    int64_t size;
+    const auto &it = live.find(addr);
+    if (it != live.end()) {
+      size = it->second;
+      live.erase(it);
+    } else {
+      size = chunk.unmatched_sizes[next_unmatched++];
+      if (size < 0) {
+        int n = snprintf(line, sizeof(line),
+                         "Addr 0x%lX is being freed but not allocated\n", addr);
+        chunk.timeline.append(line, n);
+        return;
+      }
+    }
+    resident -= size;
+    freed += size;
+    trace('f', addr, size);
+  };
+  auto alloc = [&](int64_t addr, int64_t size) {
+    const auto &inserted = live.insert({addr, size});
+    if (inserted.second && !chunk.reallocated.empty()) {
+      const auto &it = chunk.reallocated.find(addr);
+      if (it != chunk.reallocated.end()) {
+        inserted.first->second = it->second;
+        chunk.reallocated.erase(it);
+      }
+    }
+    resident += size;
+    allocated += size;
+    chunk.peak = std::max(chunk.peak, resident);
+    trace('a', addr, size);
+  };
+  Op op;
+  const char *p = chunk.begin;
+  while (parse_op(p, chunk.end, op, count)) {
+    if (op.op == 'a') {
+      alloc(op.addr, op.size);
+    } else if (op.op == 'r') {
+      if (op.old_addr) free_addr(op.old_addr);
+      alloc(op.addr, op.size);
+    } else {
+      free_addr(op.addr);
+    }
+    int n = snprintf(line, sizeof(line), "%ld\t%ld\t%ld\t%ld\t%ld\n", count,
+                     resident, allocated, resident - last_resident, freed);
+    chunk.timeline.append(line, n);
+    last_resident = resident;
+    count++;
+  }
+}
+
+template <typename F>
+void parallel_for(size_t begin, size_t end, int threads, F f) {
+  std::atomic<size_t> next(begin);
+  std::vector<std::thread> pool;
+  for (int i = 0; i < threads; i++) {
+    pool.emplace_back([&]() {
+      for (size_t c; (c = next++) < end;) f(c);
+    });
+  }
+  for (std::thread &t : pool) t.join();
+}
+
+int run_parallel(const char *file_name, int threads) {
+  int fd = open(file_name, O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    printf("Failed to open %s\n", file_name);
+    exit(EXIT_FAILURE);
+  }
+  const char *data = "";
+  if (st.st_size) {
+    data = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      printf("Failed to map %s\n", file_name);
+      exit(EXIT_FAILURE);
+    }
+  }
+  const char *data_end = data + st.st_size;
+
+  // At least 4 chunks per thread to balance, at most 16 MiB each to bound the
+  // memory for the formatted output of a batch.
+  const int64_t kMaxChunkSize = 16 << 20;
+  int64_t chunks_wanted =
+      std::max<int64_t>(threads * 4, st.st_size / kMaxChunkSize + 1);
+  std::vector<Chunk> chunks;
+  for (const char *p = data; p < data_end;) {
+    const char *end = std::min(p + st.st_size / chunks_wanted + 1, data_end);
+    end = (const char *)memchr(end, '\n', data_end - end);
+    end = end ? end + 1 : data_end;
+    chunks.emplace_back();
+    chunks.back().begin = p;
+    chunks.back().end = end;
+    p = end;
+  }
+
+  parallel_for(0, chunks.size(), threads,
+               [&](size_t c) { match_chunk(chunks[c]); });
+
+  std::unordered_map<int64_t, int64_t> live;
+  for (Chunk &chunk : chunks) {
+    chunk.start_count = count_all;
+    chunk.start_resident = resident_size;
+    chunk.start_allocated = allocation_size_accumlated;
+    chunk.start_freed = free_size_accumlated;
+    resolve_chunk(chunk, live);
+  }
+
+  trace_fp = fopen("trace.txt", "wb");
+  if (!trace_fp) {
+    printf("Failed to open trace file");
+    exit(EXIT_FAILURE);
+  }
+  for (size_t batch = 0; batch < chunks.size(); batch += threads) {
+    size_t batch_end = std::min(batch + threads, chunks.size());
+    parallel_for(batch, batch_end, threads,
+                 [&](size_t c) { format_chunk(chunks[c]); });
+    for (size_t c = batch; c < batch_end; c++) {
+      Chunk &chunk = chunks[c];
+      fwrite(chunk.timeline.data(), 1, chunk.timeline.size(), stdout);
+      fwrite(chunk.trace.data(), 1, chunk.trace.size(), trace_fp);
+      peak_size = std::max(peak_size, chunk.peak);
+      range_begin = std::min(range_begin, chunk.range_begin);
+      range_end = std::max(range_end, chunk.range_end);
+      std::string().swap(chunk.timeline);
+      std::string().swap(chunk.trace);
+    }
+  }
+  fclose(trace_fp);
+  print_summary();
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+  const char *file_name = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--threads=", 10) == 0) {
+      threads = std::max(atoi(argv[i] + 10), 1);
+    } else {
+      file_name = argv[i];
+    }
+  }
+  if (file_name) {
+    return run_parallel(file_name, threads);
+  }
+
   char op;
   int64_t addr;
   int64_t count = 0;
@@ -90,16 +461,8 @@ int main() {
     last_resident_size = resident_size;
     count++;
   }
-  fprintf(stderr, "count: %ld\n", count);
-  fprintf(stderr, "peak_size: %ld\n", peak_size);
-  fprintf(stderr, "resident_size at last: %ld\n", resident_size);
-  fprintf(stderr, "allocation_size_accumlated: %ld\n",
-      allocation_size_accumlated);
-  fprintf(stderr, "range_begin: %ld\n",
-          range_begin);
-  fprintf(stderr, "range_end: %ld\n",
-          range_end);
-  fprintf(stderr, "range_size: %ld\n",
-          range_end - range_begin);
+  count_all = count;
+  fclose(trace_fp);
+  print_summary();
   return 0;
 }
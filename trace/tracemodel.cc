@@ -0,0 +1,430 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Fits a statistical model to a recorded trace, and generates synthetic traces
+of any length with the same statistics:
+
+  ./tracemodel.bin fit [--format=hook] < trace5_bash_fizzbuzz.txt > fizzbuzz.model
+  ./tracemodel.bin gen fizzbuzz.model --ops=1000000 [--seed=1]
+      [--text=synthetic.txt] [--wl=synthetic.wl]
+
+fit reads the visualizer's text format (decimal, as the trace*_*.txt samples
+here and bintrace2text.bin output; m and u lines are skipped), or hook.c's
+trace_*.txt with --format=hook (hex, with realloc).
+
+Time is counted in allocations, like the harness counts epochs. The model is
+a set of empirical distributions:
+  size            the size of a new object
+  alloc_run       the number of allocations in a row before the next free or
+                  realloc (the burst structure)
+  lifetime.<c>    the allocations between an object's malloc and its free,
+                  for objects whose first size is in size class c (sizes in
+                  [2^(c-1), 2^c)). -1 for objects still live at the end.
+  chain.<c>       the number of reallocs an object of size class c goes
+                  through
+  realloc_gap     the allocations between two events of a realloc chain
+  realloc_ratio   new size / old size of a realloc, in 1/1000
+The model file has one "<distribution> <value> <count>" line per bin.
+
+gen draws an allocation burst, then frees and reallocs everything that is
+due, and repeats until --ops ops are written. --text writes hook.c's format
+(the addresses are just unique ids, for trace2timeline.bin). --wl writes a
+malloc_challenge workload file, to replay with
+  ./malloc_challenge.bin --workload-in=synthetic
+after writing synthetic1.wl ... synthetic5.wl (e.g. with --seed=1...5).
+There reallocs become a free and an allocation, sizes are rounded up to 8
+and clamped to [8, 4000], and objects still live at the end are never freed.
+*/
+
+class Empirical {
+ public:
+  void add(int64_t value, int64_t count = 1) {
+    bins_[value] += count;
+    total_ += count;
+    cumulative_.clear();
+  }
+  bool empty() const { return total_ == 0; }
+  int64_t total() const { return total_; }
+  const std::map<int64_t, int64_t> &bins() const { return bins_; }
+  double mean() const {
+    double sum = 0;
+    for (const auto &it : bins_) sum += (double)it.first * it.second;
+    return total_ ? sum / total_ : 0;
+  }
+  int64_t sample(std::mt19937_64 &rng) {
+    if (cumulative_.empty()) {
+      int64_t sum = 0;
+      for (const auto &it : bins_) {
+        sum += it.second;
+        cumulative_.push_back({sum, it.first});
+      }
+    }
+    int64_t r = std::uniform_int_distribution<int64_t>(0, total_ - 1)(rng);
+    auto it = std::upper_bound(
+        cumulative_.begin(), cumulative_.end(), std::make_pair(r, INT64_MAX));
+    return it->second;
+  }
+
+ private:
+  std::map<int64_t, int64_t> bins_;
+  int64_t total_ = 0;
+  std::vector<std::pair<int64_t, int64_t>> cumulative_;
+};
+
+typedef std::map<std::string, Empirical> Model;
+
+int size_class(uint64_t size) { return size ? 64 - __builtin_clzll(size) : 0; }
+
+std::string class_name(const char *name, uint64_t size) {
+  return std::string(name) + "." + std::to_string(size_class(size));
+}
+
+// [fit]
+
+struct LiveObject {
+  uint64_t size;
+  uint64_t first_size;
+  int64_t birth;
+  int64_t last_event;
+  int64_t chain;
+};
+
+int fit(bool hook_format) {
+  Model model;
+  std::unordered_map<uint64_t, LiveObject> live;
+  int64_t clock = 0;
+  int64_t run = 0;
+  int64_t ops = 0, reallocs = 0, unknown_frees = 0;
+  auto end_run = [&]() {
+    if (run) model["alloc_run"].add(run);
+    run = 0;
+  };
+  auto end_object = [&](const LiveObject &object, int64_t lifetime) {
+    model[class_name("lifetime", object.first_size)].add(lifetime);
+    model[class_name("chain", object.first_size)].add(object.chain);
+  };
+  auto alloc = [&](uint64_t addr, uint64_t size) {
+    live[addr] = {size, size, clock, clock, 0};
+    model["size"].add(size);
+    clock++;
+    run++;
+  };
+  auto free_addr = [&](uint64_t addr) {
+    end_run();
+    const auto &it = live.find(addr);
+    if (it == live.end()) {
+      unknown_frees++;
+      return;
+    }
+    end_object(it->second, clock - it->second.birth);
+    live.erase(it);
+  };
+
+  char line[256];
+  while (fgets(line, sizeof(line), stdin)) {
+    char op;
+    uint64_t addr, size = 0, old_addr = 0;
+    int n = hook_format ? sscanf(line, " %c %lX %lX %lX", &op, &addr, &size,
+                                 &old_addr)
+                        : sscanf(line, " %c %lu %lu", &op, &addr, &size);
+    if (n < 2) continue;
+    if (op == 'a') {
+      alloc(addr, size);
+    } else if (op == 'f') {
+      free_addr(addr);
+    } else if (op == 'r' && hook_format) {
+      if (!old_addr) {
+        alloc(addr, size);
+      } else if (!size) {
+        free_addr(old_addr);
+      } else if (addr) {
+        end_run();
+        const auto &it = live.find(old_addr);
+        if (it == live.end()) {
+          alloc(addr, size);
+        } else {
+          LiveObject object = it->second;
+          live.erase(it);
+          model["realloc_gap"].add(clock - object.last_event);
+          model["realloc_ratio"].add(size * 1000 / std::max<uint64_t>(object.size, 1));
+          object.size = size;
+          object.last_event = clock;
+          object.chain++;
+          live[addr] = object;
+          reallocs++;
+        }
+      }
+    } else {
+      continue;
+    }
+    ops++;
+  }
+  end_run();
+  for (const auto &it : live) end_object(it.second, -1);
+
+  for (const auto &distribution : model) {
+    for (const auto &bin : distribution.second.bins()) {
+      printf("%s %ld %ld\n", distribution.first.c_str(), bin.first,
+             bin.second);
+    }
+  }
+  fprintf(stderr, "ops: %ld\n", ops);
+  fprintf(stderr, "objects: %ld\n", clock);
+  fprintf(stderr, "live at the end: %zu\n", live.size());
+  fprintf(stderr, "reallocs: %ld\n", reallocs);
+  fprintf(stderr, "unknown frees: %ld\n", unknown_frees);
+  fprintf(stderr, "mean size: %.1f\n", model["size"].mean());
+  fprintf(stderr, "mean alloc_run: %.2f\n", model["alloc_run"].mean());
+  return 0;
+}
+
+// [gen]
+
+class Writer {
+ public:
+  virtual ~Writer() {}
+  virtual void alloc(uint64_t object, uint64_t size) = 0;
+  virtual void free(uint64_t object) = 0;
+  virtual void realloc(uint64_t new_object, uint64_t size,
+                       uint64_t old_object) = 0;
+  virtual void epoch() {}
+};
+
+// hook.c's format, with unique fake addresses.
+class TextWriter : public Writer {
+ public:
+  explicit TextWriter(FILE *fp) : fp_(fp) {}
+  ~TextWriter() { fclose(fp_); }
+  void alloc(uint64_t object, uint64_t size) override {
+    fprintf(fp_, "a %lX %lX\n", address(object), size);
+  }
+  void free(uint64_t object) override {
+    fprintf(fp_, "f %lX\n", address(object));
+  }
+  void realloc(uint64_t new_object, uint64_t size,
+               uint64_t old_object) override {
+    fprintf(fp_, "r %lX %lX %lX\n", address(new_object), size,
+            address(old_object));
+  }
+
+ private:
+  static uint64_t address(uint64_t object) { return 0x10000 + object * 16; }
+  FILE *fp_;
+};
+
+// malloc/main.c's workload file.
+class WorkloadWriter : public Writer {
+ public:
+  explicit WorkloadWriter(FILE *fp) : fp_(fp) {}
+  ~WorkloadWriter() {
+    struct {
+      char magic[4];
+      uint32_t version;
+      uint64_t ops;
+      uint64_t objects;
+      uint64_t allocated_size;
+      uint64_t freed_size;
+    } header = {{'M', 'C', 'W', 'L'}, 1, ops_.size() / 2, sizes_.size(),
+                allocated_size_, freed_size_};
+    fwrite(&header, sizeof(header), 1, fp_);
+    fwrite(ops_.data(), sizeof(uint32_t), ops_.size(), fp_);
+    fclose(fp_);
+    if (clamped_) fprintf(stderr, "clamped sizes: %ld\n", clamped_);
+  }
+  void alloc(uint64_t object, uint64_t size) override {
+    uint64_t rounded = std::min<uint64_t>(std::max<uint64_t>((size + 7) / 8 * 8, 8), 4000);
+    if (rounded < size) clamped_++;
+    if (sizes_.size() <= object) sizes_.resize(object + 1);
+    sizes_[object] = rounded;
+    allocated_size_ += rounded;
+    ops_.push_back(rounded);
+    ops_.push_back(object);
+  }
+  void free(uint64_t object) override {
+    freed_size_ += sizes_[object];
+    ops_.push_back(0);
+    ops_.push_back(object);
+  }
+  void realloc(uint64_t new_object, uint64_t size,
+               uint64_t old_object) override {
+    free(old_object);
+    alloc(new_object, size);
+  }
+  void epoch() override {
+    ops_.push_back(0);
+    ops_.push_back(UINT32_MAX);
+  }
+
+ private:
+  FILE *fp_;
+  std::vector<uint32_t> ops_;  // pairs of (size, object)
+  std::vector<uint64_t> sizes_;
+  uint64_t allocated_size_ = 0;
+  uint64_t freed_size_ = 0;
+  int64_t clamped_ = 0;
+};
+
+struct Event {
+  int64_t due;
+  int64_t seq;
+  uint64_t object;
+  uint64_t size;  // the new size for a realloc, 0 for a free
+  bool operator>(const Event &e) const {
+    return due != e.due ? due > e.due : seq > e.seq;
+  }
+};
+
+int gen(Model &model, int64_t ops_limit, uint64_t seed,
+        std::vector<Writer *> &writers) {
+  if (model["size"].empty() || model["alloc_run"].empty()) {
+    fprintf(stderr, "The model has no allocations\n");
+    return EXIT_FAILURE;
+  }
+  std::mt19937_64 rng(seed);
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  std::unordered_map<uint64_t, uint64_t> renamed;
+  // Objects are renumbered on realloc, so object ids are allocation ids.
+  uint64_t objects = 0;
+  int64_t clock = 0, seq = 0, ops = 0;
+  int64_t ops_per_epoch = std::max<int64_t>(ops_limit / 1000, 1);
+  auto emit = [&](auto f) {
+    for (Writer *w : writers) f(w);
+    ops++;
+    if (ops % ops_per_epoch == 0) {
+      for (Writer *w : writers) w->epoch();
+    }
+  };
+
+  while (ops < ops_limit) {
+    int64_t run = model["alloc_run"].sample(rng);
+    for (int64_t i = 0; i < run && ops < ops_limit; i++) {
+      uint64_t size = model["size"].sample(rng);
+      uint64_t object = objects++;
+      emit([&](Writer *w) { w->alloc(object, size); });
+
+      // Schedule its reallocs and its free.
+      Empirical &chain = model[class_name("chain", size)];
+      Empirical &lifetime = model[class_name("lifetime", size)];
+      int64_t reallocs = chain.empty() ? 0 : chain.sample(rng);
+      int64_t t = clock;
+      uint64_t realloc_size = size;
+      for (int64_t j = 0; j < reallocs && !model["realloc_gap"].empty(); j++) {
+        t += model["realloc_gap"].sample(rng);
+        realloc_size = std::max<uint64_t>(
+            realloc_size * model["realloc_ratio"].sample(rng) / 1000, 1);
+        events.push({t, seq++, object, realloc_size});
+      }
+      int64_t life = lifetime.empty() ? -1 : lifetime.sample(rng);
+      if (life >= 0) {
+        events.push({std::max(clock + life, t), seq++, object, 0});
+      }
+      clock++;
+    }
+    // Bursts are separated by at least one free or realloc, as in the trace.
+    bool separated = false;
+    while (!events.empty() && ops < ops_limit &&
+           (events.top().due <= clock || !separated)) {
+      separated = true;
+      Event e = events.top();
+      events.pop();
+      // A realloc gives the object a new id, events keep the first one.
+      uint64_t object = e.object;
+      const auto &it = renamed.find(e.object);
+      if (it != renamed.end()) object = it->second;
+      if (e.size) {
+        uint64_t new_object = objects++;
+        emit([&](Writer *w) { w->realloc(new_object, e.size, object); });
+        renamed[e.object] = new_object;
+      } else {
+        emit([&](Writer *w) { w->free(object); });
+        renamed.erase(e.object);
+      }
+    }
+  }
+  fprintf(stderr, "ops: %ld\n", ops);
+  fprintf(stderr, "objects: %lu\n", objects);
+  return 0;
+}
+
+Model load_model(const char *file_name) {
+  FILE *fp = fopen(file_name, "r");
+  if (!fp) {
+    fprintf(stderr, "Failed to open %s\n", file_name);
+    exit(EXIT_FAILURE);
+  }
+  Model model;
+  char name[64];
+  int64_t value, count;
+  while (fscanf(fp, " %63s %ld %ld", name, &value, &count) == 3) {
+    model[name].add(value, count);
+  }
+  fclose(fp);
+  return model;
+}
+
+FILE *open_output(const char *file_name) {
+  FILE *fp = fopen(file_name, "wb");
+  if (!fp) {
+    fprintf(stderr, "Failed to open %s\n", file_name);
+    exit(EXIT_FAILURE);
+  }
+  return fp;
+}
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s fit [--format=hook] < trace.txt > trace.model\n"
+          "       %s gen trace.model --ops=N [--seed=S] [--text=FILE] "
+          "[--wl=FILE]\n",
+          argv0, argv0);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  if (argc >= 2 && strcmp(argv[1], "fit") == 0) {
+    bool hook_format = false;
+    for (int i = 2; i < argc; i++) {
+      if (strcmp(argv[i], "--format=hook") == 0) {
+        hook_format = true;
+      } else {
+        usage(argv[0]);
+      }
+    }
+    return fit(hook_format);
+  }
+  if (argc >= 3 && strcmp(argv[1], "gen") == 0) {
+    Model model = load_model(argv[2]);
+    int64_t ops = 0;
+    uint64_t seed = 1;
+    std::vector<Writer *> writers;
+    for (int i = 3; i < argc; i++) {
+      if (strncmp(argv[i], "--ops=", 6) == 0) {
+        ops = strtoll(argv[i] + 6, NULL, 10);
+      } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+        seed = strtoull(argv[i] + 7, NULL, 10);
+      } else if (strncmp(argv[i], "--text=", 7) == 0) {
+        writers.push_back(new TextWriter(open_output(argv[i] + 7)));
+      } else if (strncmp(argv[i], "--wl=", 5) == 0) {
+        writers.push_back(new WorkloadWriter(open_output(argv[i] + 5)));
+      } else {
+        usage(argv[0]);
+      }
+    }
+    if (ops <= 0 || writers.empty()) usage(argv[0]);
+    int ret = gen(model, ops, seed, writers);
+    for (Writer *w : writers) delete w;
+    return ret;
+  }
+  usage(argv[0]);
+}
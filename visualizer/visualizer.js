@@ -144,10 +144,8 @@ function loadData(input) {
   console.assert(range_begin <= range_end);
   console.log(`[${range_begin}, ${range_end})`);
 
-  if (window.malloc_trace) {
-    window.malloc_trace.chart.destroy();
-  }
-
+  destroyChart();
+  window.malloc_tiles = null;
   window.malloc_trace = {};
   window.malloc_trace.ops = ops;
   window.malloc_trace.range_begin = range_begin;
@@ -158,22 +156,32 @@ function loadData(input) {
 
   drawVisualizer(256);
 
-  // chart
+  drawChart(stat_allocated_labels, stat_allocated_now, stat_mapped_now);
+}
+
+function destroyChart() {
+  if (window.malloc_chart) {
+    window.malloc_chart.destroy();
+    window.malloc_chart = null;
+  }
+}
+
+function drawChart(labels, allocated_now, mapped_now) {
   const data = {
-    labels: stat_allocated_labels,
+    labels: labels,
     datasets: [
       {
         label: 'allocated_now',
         backgroundColor: '#03af7a',
         borderColor: '#03af7a',
-        data: stat_allocated_now,
+        data: allocated_now,
         fill: 'origin',
       },
       {
         label: 'mapped_now',
         backgroundColor: '#4dc4ff',
         borderColor: '#4dc4ff',
-        data: stat_mapped_now,
+        data: mapped_now,
         fill: 'origin',
       }
     ]
@@ -199,11 +207,14 @@ function loadData(input) {
   };
   const chartCanvas = document.getElementById('chart');
   chartCanvas.height = 200;
-  window.malloc_trace.chart =
-      new Chart(document.getElementById('chart'), config);
+  window.malloc_chart = new Chart(document.getElementById('chart'), config);
 }
 
 function drawVisualizer() {
+  if (window.malloc_tiles) {
+    drawVisualizerFromTiles();
+    return;
+  }
   const t = window.malloc_trace;
   drawPixelsFromTrace(
       t.range_begin, t.range_end, t.ops, Math.pow(2, hsegments.value),
@@ -234,6 +245,145 @@ function handleDragOver(evt) {
   evt.dataTransfer.dropEffect = 'copy';  // Explicitly show this is a copy.
 }
 
+// Tile mode: traces too large to drop here can be preprocessed by
+// trace/trace2tiles.bin into a directory, served over HTTP next to this page
+// (e.g. `python3 -m http.server` at the repo root and open
+// visualizer/index.html?tiles=../trace/tiles5_my/). Only the index, the tiles
+// around the current progress, and one snapshot + chunk are fetched; the
+// snapshot and the chunk are replayed up to the progress position.
+const tilesLevel = document.querySelector('#tilesLevel');
+tilesLevel.addEventListener('input', (event) => {
+  drawVisualizer();
+});
+
+function fetchCached(path, type) {
+  const t = window.malloc_tiles;
+  if (!t.cache.has(path)) {
+    t.cache.set(path, fetch(t.url + path).then((r) => {
+      if (!r.ok) throw new Error(`${path}: ${r.status}`);
+      return type == 'text' ? r.text() : r.arrayBuffer();
+    }));
+    // Snapshots and chunks are large, keep only the recent ones.
+    if (t.cache.size > 256) {
+      t.cache.delete(t.cache.keys().next().value);
+    }
+  }
+  return t.cache.get(path);
+}
+
+function parseChunk(text) {
+  // Upper case ops continue the previous op, so they don't count as one.
+  return text.split('\n')
+      .map(s => s.trim().split(' '))
+      .filter(e => e.length == 3)
+      .map(e => [e[0], parseInt(e[1], 10), parseInt(e[2], 10)]);
+}
+
+async function loadTiles(url) {
+  if (!url.endsWith('/')) url += '/';
+  const index = await (await fetch(url + 'index.json')).json();
+  destroyChart();
+  window.malloc_trace = null;
+  window.malloc_tiles = {url, index, cache: new Map(), generation: 0};
+  progress.max = index.ops;
+  progress.value = 0;
+  opsPerSecInput.value = Math.ceil(index.ops / 5);
+  tilesLevel.max = index.levels.length - 1;
+  tilesLevel.value = index.levels.length - 1;
+  drawChart(
+      index.allocated.map((e, i) => (i + 1) * index.ops_per_row),
+      index.allocated, index.mapped);
+  drawVisualizer();
+}
+
+async function drawVisualizerFromTiles() {
+  const t = window.malloc_tiles;
+  const index = t.index;
+  const generation = ++t.generation;
+  const p = Number(progress.value);
+
+  // The tile row of the pyramid around the progress position.
+  const level = Number(tilesLevel.value);
+  const opsPerRow = index.ops_per_row * Math.pow(2, level);
+  const row = Math.min(
+      Math.floor(p / opsPerRow), Math.max(index.levels[level].rows - 1, 0));
+  const y = Math.floor(row / index.tile_size);
+  const columns = index.levels[level].columns;
+  const tiles = [];
+  for (let x = 0; x * index.tile_size < columns; x++) {
+    tiles.push(fetchCached(`tiles/${level}/${y}_${x}.bin`, 'binary'));
+  }
+
+  // The state at the progress position.
+  const chunk = Math.floor(p / index.ops_per_chunk);
+  const snapshot = fetchCached(`snapshots/${chunk}.txt`, 'text');
+  const ops = fetchCached(`chunks/${chunk}.txt`, 'text');
+
+  const tileData = await Promise.all(tiles);
+  const snapshotOps = parseChunk(await snapshot);
+  const chunkOps = parseChunk(await ops);
+  if (generation != t.generation) return;
+
+  drawTiles(tileData, columns, row % index.tile_size, index.tile_size);
+
+  let replay = snapshotOps;
+  let count = chunk * index.ops_per_chunk;
+  for (const e of chunkOps) {
+    if (e[0] == e[0].toLowerCase()) {
+      if (count == p) break;
+      count++;
+    }
+    replay.push([e[0].toLowerCase(), e[1], e[2]]);
+  }
+  drawPixelsFromTrace(
+      0, index.range_size, replay, Math.pow(2, hsegments.value),
+      replay.length);
+  progressSpan.innerText = `${p} / ${index.ops}`;
+  tilesLevelSpan.innerText =
+      `${opsPerRow} ops x ${index.bytes_per_column * Math.pow(2, level)} bytes`;
+}
+
+const tilesLevelSpan = document.querySelector('#tilesLevelSpan');
+function drawTiles(tileData, columns, markerRow, tileSize) {
+  const w = columns;
+  const h = tileSize;
+  const backedCanvas = document.querySelector('#backedCanvas');
+  backedCanvas.width = w;
+  backedCanvas.height = h;
+  const backedContext = backedCanvas.getContext('2d');
+  const backedImageData = backedContext.getImageData(0, 0, w, h);
+  for (let x = 0; x < tileData.length; x++) {
+    const tile = new Uint8Array(tileData[x]);
+    for (let r = 0; r < h; r++) {
+      for (let c = 0; c < tileSize && x * tileSize + c < w; c++) {
+        // Blend by the allocated and the mapped fraction of the pixel.
+        const allocated = tile[(r * tileSize + c) * 2] / 255;
+        const mapped = Math.max(tile[(r * tileSize + c) * 2 + 1] / 255, allocated);
+        const i = (r * w + x * tileSize + c) * 4;
+        for (let ch = 0; ch < 3; ch++) {
+          backedImageData.data[i + ch] = colorMap[0][ch] * (1 - mapped) +
+              colorMap[2][ch] * (mapped - allocated) +
+              colorMap[4][ch] * allocated;
+        }
+        backedImageData.data[i + 3] = r == markerRow ? 0x80 : 0xff;
+      }
+    }
+  }
+  backedContext.putImageData(backedImageData, 0, 0);
+
+  const canvas = document.querySelector('#tilesCanvas');
+  canvas.width = canvas.offsetWidth;
+  canvas.height = Math.min(canvas.width, 512);
+  const ctx = canvas.getContext('2d');
+  ctx.imageSmoothingEnabled = false;
+  ctx.scale(canvas.width / w, canvas.height / h);
+  ctx.drawImage(backedCanvas, 0, 0);
+}
+
+document.getElementById('loadTilesButton').addEventListener('click', () => {
+  loadTiles(document.getElementById('tilesUrl').value);
+}, false);
+
 const input = `
   m 0 400
   a 0 100
@@ -247,7 +397,13 @@ const input = `
   u 0 400
 `;
 
-loadData(input);
+const tilesParam = new URLSearchParams(window.location.search).get('tiles');
+if (tilesParam) {
+  document.getElementById('tilesUrl').value = tilesParam;
+  loadTiles(tilesParam);
+} else {
+  loadData(input);
+}
 
 
 const dropZone = document.getElementById('fileDropZone');